@@ -4,14 +4,17 @@
 #include <iostream>
 #include <pwd.h>
 #include <string>
+#include <vector>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "noaftodo_config.h"
 #include "noaftodo_cui.h"
 #include "noaftodo_daemon.h"
+#include "noaftodo_import.h"
 #include "noaftodo_list.h"
 #include "noaftodo_output.h"
+#include "noaftodo_server.h"
 
 using namespace std;
 
@@ -22,6 +25,8 @@ int main(int argc, char* argv[])
 	log(string(TITLE) + " v." + string(VERSION));
 
 	int mode = PM_DEFAULT;
+	string im_filename;
+	vector<string> lists;	// the daemon serves all of them
 
 	li_filename = string(getpwuid(getuid())->pw_dir) + "/.noaftodo-list";
 	conf_filename = string(getpwuid(getuid())->pw_dir) + "/.config/noaftodo.conf";
@@ -41,6 +46,32 @@ int main(int argc, char* argv[])
 			da_send("N");
 			return 0;
 		} 
+		else if (strcmp(argv[i], "-s") * strcmp(argv[i], "--stats") == 0)
+		{
+			string report;
+			if (!da_stats(report)) return 1;
+
+			cout << report;
+			return 0;
+		}
+		else if (strcmp(argv[i], "-x") * strcmp(argv[i], "--exec") == 0)
+		{
+			if (i < argc - 1)
+			{
+				string status;
+				const int code = sv_exec(argv[i + 1], status);
+				if (status != "") cout << status << endl;
+				return code;
+			} else {
+				log("Command not specified after " + string(argv[i]), LP_ERROR);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "-f") * strcmp(argv[i], "--feed") == 0)
+		{
+			if ((i < argc - 1) && (argv[i + 1][0] != '-')) return sv_follow(argv[i + 1]);
+			else return sv_follow("");
+		}
 		else if (strcmp(argv[i], "-c") * strcmp(argv[i], "--config") == 0)
 		{
 			if (i < argc - 1)
@@ -52,11 +83,24 @@ int main(int argc, char* argv[])
 				return 1;
 			}
 		}
+		else if (strcmp(argv[i], "-i") * strcmp(argv[i], "--import") == 0)
+		{
+			if (i < argc - 1)
+			{
+				mode = PM_IMPORT;
+				im_filename = string(argv[i + 1]);
+				i++;
+			} else {
+				log("File to import not specified after " + string(argv[i]), LP_ERROR);
+				return 1;
+			}
+		}
 		else if (strcmp(argv[i], "-l") * strcmp(argv[i], "--list") == 0)
 		{
 			if (i < argc - 1)
 			{
 				li_filename = string(argv[i + 1]);
+				lists.push_back(li_filename);
 				i++;
 			} else {
 				log("List file not specified after " + string(argv[i]), LP_ERROR);
@@ -74,15 +118,26 @@ int main(int argc, char* argv[])
 	// load the config
 	conf_load();
 
-	// load the list
-	li_load();
+	if (mode == PM_DAEMON)
+	{
+		// the daemon loads the lists itself
+		if (lists.empty()) lists.push_back(li_filename);
+		da_run(lists);
+
+		return 0;
+	}
+
+	// load the list. If the daemon owns it, get it from the daemon
+	if (!sv_connect()) li_load();
 
 	if (mode == PM_DEFAULT)
 	{
 		cui_run();
 	}
 
-	if (mode == PM_DAEMON) da_run();
+	if (mode == PM_IMPORT) im_import(im_filename);
+
+	li_flush();
 
 	return 0;
 }
@@ -93,8 +148,12 @@ void print_help()
 	cout << "Command-line options:" << endl;
 	cout << "\t-h, --help - print this message" << endl;
 	cout << "\t-c, --config - specify config file after this parameter" << endl;
-	cout << "\t-l, --list - specify list file after this parameter" << endl;
+	cout << "\t-l, --list - specify list file after this parameter. The daemon takes several" << endl;
 	cout << "\t-d, --daemon - start " << TITLE << " daemon" << endl;
-	cout << "\t-k, --kill-daemon - kill " << TITLE << " daemon" << endl;
+	cout << "\t-k, --kill-daemon - stop the daemon of the list (given with -l before this parameter)" << endl;
 	cout << "\t-r, --refire - if daemon is running, re-fire startup events" << endl;
+	cout << "\t-s, --stats - print what the daemon counted and timed" << endl;
+	cout << "\t-x, --exec - run the command specified after this parameter in the daemon (server mode)" << endl;
+	cout << "\t-f, --feed - print the list and its changes as the daemon (server mode) makes them. A position (<generation>:<changes>) after this parameter - only the changes after it" << endl;
+	cout << "\t-i, --import - import tasks from a CSV, TSV or NDJSON file (\"-\" - standard input) specified after this parameter" << endl;
 }
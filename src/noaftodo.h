@@ -9,6 +9,7 @@ constexpr char VERSION[] = "1.1.2";
 constexpr int PM_DEFAULT = 0;
 constexpr int PM_HELP = 1;
 constexpr int PM_DAEMON = 2;
+constexpr int PM_IMPORT = 3;
 
 void print_help();
 
@@ -1,5 +1,6 @@
 #include "noaftodo_cmd.h"
 
+#include <algorithm>
 #include <cstdlib>
 #ifdef __sun
 #include <ncurses/curses.h>
@@ -9,8 +10,11 @@
 
 #include "noaftodo_config.h"
 #include "noaftodo_cui.h"
+#include "noaftodo_exec.h"
+#include "noaftodo_import.h"
 #include "noaftodo_list.h"
 #include "noaftodo_output.h"
+#include "noaftodo_server.h"
 #include "noaftodo_time.h"
 
 using namespace std;
@@ -23,10 +27,12 @@ int cmd_exec(const string& command)
 	bool skip_special = false;
 
 	if (command != "") if (command.at(0) == '!')
-		if (cui_s_line >= 0) system(format_str(command.substr(1), t_list.at(cui_s_line)).c_str());
-		else system(command.substr(1).c_str());
+	{
+		if ((cui_s_line >= 0) && (cui_s_line < (int)t_list.size())) ex_run(format_str(command.substr(1), t_list.at(cui_s_line)));
+		else ex_run(command.substr(1));
+	}
 
-	for (int i = 0; i < command.length(); i++)
+	for (int i = 0; i < (int)command.length(); i++)
 	{
 		const char c = command.at(i);
 
@@ -68,15 +74,45 @@ int cmd_exec(const string& command)
 	}
 	if (word != "") words.push_back(word);
 
+	// several commands at once are a bulk edit: the list is saved once
+	// after all of them. Tasks added by "a" are sorted in before the next
+	// command that is not an "a", see cmd_exec(words)
+	if (find(words.begin(), words.end(), ";") != words.end())
+	{
+		li_bulk_begin();
+		const int ret = cmd_exec(words);
+		li_bulk_end();
+
+		return ret;
+	}
+
+	return cmd_exec(words);
+}
+
+int cmd_exec(const vector<string>& words)
+{
 	int offset = 0;
-	for (int i = 0; i < words.size(); i++)
+	for (int i = 0; i < (int)words.size(); i++)
 	{
 		if (words.at(i) == ";") // command separator
 			offset = i + 1;
 		else if (i == offset)
 		{
+			// commands other than "a" can point at tasks by their position
+			// ("g", "up", the selected line): within a bulk edit, the tasks
+			// appended so far are put in their places first
+			if ((li_bulk > 0) && !li_sorted && (words.at(offset) != "a")) li_sort();
+
+			// the modes are the console UI's: the daemon and scripts have none
+			const bool mode_switch = (words.at(i) == ":") || (words.at(i) == "details") || (words.at(i) == "?");
+
 			if (words.at(i) == "q") // exit the program
 				cui_mode = CUI_MODE_EXIT;
+			else if (mode_switch && !cui_active)
+			{
+				cui_status = "\"" + words.at(i) + "\" works in the console UI only";
+				return 1;
+			}
 			else if (words.at(i) == ":") // enter command mode
 				cui_set_mode(CUI_MODE_COMMAND);
 			else if (words.at(i) == "details") // show selected task details
@@ -85,7 +121,7 @@ int cmd_exec(const string& command)
 				cui_set_mode(CUI_MODE_HELP);
 			else if (words.at(i) == "list") // navigate to list (":list all" to view tasks from all lists)
 			{
-				if (words.size() >= i + 2)
+				if ((int)words.size() >= i + 2)
 				{
 					if (words.at(i + 1) == "all") conf_set_cvar_int("tag_filter", CUI_TAG_ALL);
 					else
@@ -100,10 +136,14 @@ int cmd_exec(const string& command)
 			{
 				if (t_list.size() != 0)
 				{
-					if (cui_s_line < t_list.size() - 1) cui_s_line++;
-					else cui_s_line = 0;
+					// to the next visible one. If none is, once around the list
+					for (int step = 0; step < (int)t_list.size(); step++)
+					{
+						if (cui_s_line < (int)t_list.size() - 1) cui_select(cui_s_line + 1);
+						else cui_select(0);
 
-					if (!cui_is_visible(cui_s_line)) cmd_exec("down");
+						if (cui_is_visible(cui_s_line)) break;
+					}
 
 					cui_delta = 0;
 				} else return 2;
@@ -111,10 +151,13 @@ int cmd_exec(const string& command)
 			{
 				if (t_list.size() != 0)
 				{
-					if (cui_s_line > 0) cui_s_line--;
-					else cui_s_line = t_list.size() - 1;
+					for (int step = 0; step < (int)t_list.size(); step++)
+					{
+						if (cui_s_line > 0) cui_select(cui_s_line - 1);
+						else cui_select(t_list.size() - 1);
 
-					if (!cui_is_visible(cui_s_line)) cmd_exec("up");
+						if (cui_is_visible(cui_s_line)) break;
+					}
 
 					cui_delta = 0;
 				} else return 2;
@@ -123,22 +166,28 @@ int cmd_exec(const string& command)
 				if (t_list.size() == 0)
 					return 2;
 				else
-					li_comp(cui_s_line);
+				{
+					cui_sync_selection();
+					li_comp(cui_s_id);
+				}
 			} else if (words.at(i) == "d") // remove selected task
 			{
 				if (t_list.size() == 0)
 					return 2;
 				else
 				{
-					li_rem(cui_s_line);
-					if (t_list.size() != 0) if (cui_s_line >= t_list.size()) cmd_exec("up");
+					// nothing may be selected yet: then it's the selected line
+					cui_sync_selection();
+					li_rem(cui_s_id);
+					if ((t_list.size() != 0) && (cui_s_line >= (int)t_list.size())) cmd_exec("up");
 				}
 			} else if (words.at(i) == "a") // add a task
 			{
-				if (words.size() >= i + 4)
+				if ((int)words.size() >= i + 4)
 				{
 					noaftodo_entry new_entry;
 					new_entry.completed = false;
+					new_entry.id = 0;
 					if (words.at(i + 1) != "")
 					{
 						new_entry.due = ti_to_long(words.at(i + 1));
@@ -158,7 +207,7 @@ int cmd_exec(const string& command)
 				} else return 1;
 			} else if (words.at(i) == "vtoggle") // toggle filters. Supported filters: uncat, complete, coming, failed
 			{
-				if (words.size() >= i + 2)
+				if ((int)words.size() >= i + 2)
 				{
 					int filter = conf_get_cvar_int("filter");
 					if (words.at(i + 1) == "uncat")
@@ -173,45 +222,71 @@ int cmd_exec(const string& command)
 				} else return 1;
 			} else if (words.at(i) == "g") // go to task
 			{
-				if (words.size() >= i + 2)
+				if ((int)words.size() >= i + 2)
 				{
 					const int target = stoi(words.at(i + 1));
 
-					if ((target >= 0) && (target < t_list.size()))
-						cui_s_line = target;
+					if ((target >= 0) && (target < (int)t_list.size()))
+						cui_select(target);
 				} else return 1;
 			} else if (words.at(i) == "lrename") // rename list
 			{
-				if (words.size() >= i + 2)
+				if ((int)words.size() >= i + 2)
 				{
 					const int tag_filter = conf_get_cvar_int("tag_filter");
 					if (tag_filter == CUI_TAG_ALL) cui_status = "No specific list selected";
-					else 
-					{
-						while (tag_filter >= t_tags.size()) t_tags.push_back(to_string(t_tags.size()));
-
-						t_tags[tag_filter] = words.at(i + 1);
-						li_save();
-					}
+					else li_tag_rename(tag_filter, words.at(i + 1));
 				} else return 1;
 			}
 		       	else if (words.at(i) == "lmv") // move selected task to a list
 			{
-				if (words.size() >= i + 2)
+				if ((int)words.size() >= i + 2)
+				{
+					if (t_list.size() == 0) return 2;
+
+					cui_sync_selection();
+					li_mv(cui_s_id, stoi(words.at(i + 1)));
+				} else return 1;
+			}
+			else if (words.at(i) == "lformat") // convert list file to another format: text or binary
+			{
+				if ((int)words.size() >= i + 2)
+				{
+					// the daemon owns the list file
+					if (sv_remote) return sv_exec(words.at(i) + " " + words.at(i + 1), cui_status);
+
+					if (words.at(i + 1) == "text") li_convert(LI_FORMAT_TEXT);
+					else if (words.at(i + 1) == "binary") li_convert(LI_FORMAT_BINARY);
+					else return 1;
+				} else return 1;
+			}
+			else if (words.at(i) == "llayout") // store lists in one file or each list in its own file: single or sharded
+			{
+				if ((int)words.size() >= i + 2)
+				{
+					if (sv_remote) return sv_exec(words.at(i) + " " + words.at(i + 1), cui_status);
+
+					if (words.at(i + 1) == "single") li_layout(false);
+					else if (words.at(i + 1) == "sharded") li_layout(true);
+					else return 1;
+				} else return 1;
+			}
+			else if (words.at(i) == "import") // import tasks from a CSV, TSV or NDJSON file
+			{
+				if ((int)words.size() >= i + 2)
 				{
-					t_list[cui_s_line].tag = stoi(words.at(i + 1));
-					li_save();
+					cui_status = to_string(im_import(words.at(i + 1))) + " tasks imported";
 				} else return 1;
 			}
 			else if (words.at(i) == "get") // get cvar value
 			{
-				if (words.size() >= i + 2)
+				if ((int)words.size() >= i + 2)
 				{
 					cui_status = conf_get_cvar(words.at(i + 1));
 				} else return 1;
 			} else if (words.at(i) == "bind") // bind a key
 			{
-				if (words.size() == i + 5)
+				if ((int)words.size() == i + 5)
 				{
 					const string skey = words.at(i + 1);
 					const string scomm = words.at(i + 2);
@@ -239,13 +314,13 @@ int cmd_exec(const string& command)
 				} else return 1;
 			} else if (words.at(i) == "set") // set cvar value
 			{
-				if (words.size() == i + 3)
+				if ((int)words.size() == i + 3)
 				{
 					conf_set_cvar(words.at(i + 1), words.at(i + 2));
 				} else return 1;
 			} else if (words.at(i) == "reset") // reset cvar value to default
 			{
-				if (words.size() == i + 2)
+				if ((int)words.size() == i + 2)
 				{
 					if (conf_get_predefined_cvar(words.at(i + 1)) != "")
 						conf_set_cvar(words.at(i + 1), conf_get_predefined_cvar(words.at(i + 1)));
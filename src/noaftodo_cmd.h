@@ -2,7 +2,9 @@
 #define NOAFTODO_CMD_H
 
 #include <string>
+#include <vector>
 
 int cmd_exec(const std::string& command);
+int cmd_exec(const std::vector<std::string>& words);	// run an already split command
 
 #endif
@@ -12,6 +12,7 @@
 #include "noaftodo_cmd.h"
 #include "noaftodo_config.h"
 #include "noaftodo_output.h"
+#include "noaftodo_server.h"
 #include "noaftodo_time.h"
 
 using namespace std;
@@ -20,6 +21,7 @@ map<char, cui_col_s> cui_columns;
 
 int cui_mode;
 stack<int> cui_prev_modes;
+bool cui_active = false;
 
 vector<cui_bind_s> binds;
 
@@ -28,6 +30,7 @@ int cui_w, cui_h;
 string cui_status = "Welcome to " + string(TITLE) + "!";
 
 int cui_s_line;
+uint64_t cui_s_id = 0;
 int cui_delta;
 int cui_numbuffer = -1;
 
@@ -48,25 +51,25 @@ void cui_init()
 	cui_columns['t'] = 
 	{ 
 		"Task Title", 
-		[](const int& w, const int& free, const int& cols)
+		[](const int&, const int& free, const int&)
 		{
 			return free / 4;
 		},
-		[](const noaftodo_entry& e, const int& id) 
+		[](const noaftodo_entry& e, const int&) 
 		{ 
-			return e.title; 
+			return string(e.title); 
 		} 
 	};
 	cui_columns['l'] = 
 	{ 
 		"List", 
-		[](const int& w, const int& free, const int& cols)
+		[](const int&, const int& free, const int&)
 		{
 			return free / 10;
 		},
-		[](const noaftodo_entry& e, const int& id) 
+		[](const noaftodo_entry& e, const int&) 
 		{ 
-			if (e.tag < t_tags.size())
+			if (e.tag < (int)t_tags.size())
 			       if (t_tags.at(e.tag) != to_string(e.tag))
 				       return to_string(e.tag) + ": " + t_tags.at(e.tag);
 
@@ -76,11 +79,11 @@ void cui_init()
 	cui_columns['d'] = 
 	{ 
 		"Due", 
-		[](const int& w, const int& free, const int& cols)
+		[](const int&, const int&, const int&)
 		{
 			return 16;
 		},
-		[](const noaftodo_entry& e, const int& id) 
+		[](const noaftodo_entry& e, const int&) 
 		{ 
 			return ti_f_str(e.due); 
 		} 
@@ -88,23 +91,23 @@ void cui_init()
 	cui_columns['D'] = 
 	{ 
 		"Task description", 
-		[](const int& w, const int& free, const int& cols)
+		[](const int&, const int& free, const int&)
 		{
 			return free;
 		},
-		[](const noaftodo_entry& e, const int& id) 
+		[](const noaftodo_entry& e, const int&) 
 		{ 
-			return e.description; 
+			return string(li_description(e)); 
 		} 
 	};
 	cui_columns['i'] = 
 	{ 
 		"ID", 
-		[](const int& w, const int& free, const int& cols)
+		[](const int&, const int&, const int&)
 		{
 			return 3;
 		},
-		[](const noaftodo_entry& e, const int& id) 
+		[](const noaftodo_entry&, const int& id) 
 		{ 
 			return to_string(id); 
 		} 
@@ -129,11 +132,15 @@ void cui_init()
 
 	cui_w = getmaxx(stdscr);
 	cui_h = getmaxy(stdscr);
+
+	cui_active = true;
 }
 
 void cui_destroy()
 {
 	endwin();
+
+	cui_active = false;
 }
 
 void cui_run()
@@ -145,7 +152,7 @@ void cui_run()
 	{
 		bool bind_fired = false;
 		for (const auto& bind : binds)
-			if ((bind.mode & cui_mode) && (bind.key == c))
+			if ((bind.mode & cui_mode) && ((wint_t)bind.key == c))
 			{
 				if (bind.autoexec) cmd_exec(bind.command);
 				else 
@@ -174,6 +181,9 @@ void cui_run()
 				cui_help_input(c);
 		}
 
+		// changes others made through the daemon
+		sv_poll();
+
 		cui_w = getmaxx(stdscr);
 		cui_h = getmaxy(stdscr);
 
@@ -207,8 +217,12 @@ void cui_set_mode(const int& mode)
 {
 	if (mode == -1)
 	{
-		cui_mode = cui_prev_modes.top();
-		cui_prev_modes.pop();
+		if (cui_prev_modes.empty()) cui_mode = CUI_MODE_NORMAL;
+		else
+		{
+			cui_mode = cui_prev_modes.top();
+			cui_prev_modes.pop();
+		}
 	} else {
 		if ((cui_mode != CUI_MODE_COMMAND) && (cui_mode != mode)) cui_prev_modes.push(cui_mode);
 		cui_mode = mode;
@@ -227,6 +241,7 @@ void cui_set_mode(const int& mode)
 			break;
 		case CUI_MODE_COMMAND:
 			curs_set(1);
+			if (cui_commands.empty()) cui_commands.push_back(L"");
 			cui_command_index = cui_commands.size() - 1;
 			cui_command_cursor = cui_commands[cui_commands.size() - 1].length();
 			break;
@@ -247,20 +262,43 @@ void cui_bind(const wchar_t& key, const string& command, const int& mode, const
 	cui_bind({ key, command, mode, autoexec });
 }
 
+void cui_select(const int& entryID)
+{
+	if ((entryID < 0) || (entryID >= (int)t_list.size())) return;
+
+	cui_s_line = entryID;
+	cui_s_id = t_list.at(entryID).id;
+}
+
+void cui_sync_selection()
+{
+	if (t_list.size() == 0)
+	{
+		cui_s_line = -1;
+		cui_s_id = 0;
+		return;
+	}
+
+	// follow the selected entry. If it's gone, stay where it was
+	const int entryID = li_find(cui_s_id);
+	if (entryID != -1) cui_s_line = entryID;
+	else
+	{
+		if (cui_s_line >= (int)t_list.size()) cui_s_line = t_list.size() - 1;
+		if (cui_s_line < 0) cui_s_line = 0;
+		cui_s_id = t_list.at(cui_s_line).id;
+	}
+}
+
 bool cui_is_visible(const int& entryID)
 {
 	if (t_list.size() == 0) return false;
-	const auto& entry = t_list.at(entryID);
 
 	const int tag_filter = conf_get_cvar_int("tag_filter");
 	const int filter = conf_get_cvar_int("filter");
-	const bool tag_check = ((tag_filter == CUI_TAG_ALL) || (tag_filter == entry.tag));
+	const bool tag_check = ((tag_filter == CUI_TAG_ALL) || (tag_filter == li_cols.tag.at(entryID)));
 
-	if (entry.completed) return tag_check && (filter & CUI_FILTER_COMPLETE);
-	if (entry.due <= ti_to_long("a0d")) return tag_check && (filter & CUI_FILTER_FAILED);
-	if (entry.due <= ti_to_long("a1d")) return tag_check && (filter & CUI_FILTER_COMING);
-
-	return tag_check && (filter & CUI_FILTER_UNCAT);
+	return tag_check && (filter & li_cols.state.at(entryID));
 }
 
 void cui_normal_paint()
@@ -268,6 +306,14 @@ void cui_normal_paint()
 	const int tag_filter = conf_get_cvar_int("tag_filter");
 	const int filter = conf_get_cvar_int("filter");
 
+	// the list is read the first time it's shown
+	li_shard_need(tag_filter);
+
+	// the whole frame is drawn for the same time
+	li_update_states(ti_snapshot());
+
+	cui_sync_selection();
+
 	// draw table title
 	move(0, 0);
 	attrset(A_STANDOUT | A_BOLD | COLOR_PAIR(CUI_CP_TITLE));
@@ -275,7 +321,7 @@ void cui_normal_paint()
 
 	int x = 0;
 	const string cols = (tag_filter == CUI_TAG_ALL) ? conf_get_cvar("all_cols") : conf_get_cvar("cols");
-	for (int coln = 0; coln < cols.length(); coln++)
+	for (int coln = 0; coln < (int)cols.length(); coln++)
 	{
 		try
 		{
@@ -285,20 +331,22 @@ void cui_normal_paint()
 			const int w = cui_columns.at(col).width(cui_w, cui_w - x, cols.length());
 			addstr(cui_columns.at(col).title.c_str());
 
-			if (coln < cols.length() - 1) if (x + w < cui_w)
+			if (coln < (int)cols.length() - 1) if (x + w < cui_w)
 			{
 				move(0, x + w);
 				addstr((" " + conf_get_cvar("charset.row_separator") + " ").c_str());
 			}
 			x += w + 3;
-		} catch (out_of_range e) {}
+		} catch (const out_of_range& e) {}
 	}
 	attrset(A_NORMAL);
 
+	const vector<uint8_t>& states = li_cols.state;
+
 	vector<int> v_list;
 	int cui_v_line = -1;
-	for (int l = 0; l < t_list.size(); l++)
-		if (cui_is_visible(l)) 
+	for (int l = 0; l < (int)t_list.size(); l++)
+		if ((states[l] & filter) && ((tag_filter == CUI_TAG_ALL) || (tag_filter == li_cols.tag[l])))
 		{
 			v_list.push_back(l);
 			if (l == cui_s_line) cui_v_line = v_list.size() - 1;
@@ -307,7 +355,7 @@ void cui_normal_paint()
 	if (v_list.size() != 0) 
 	{
 		while (!cui_is_visible(cui_s_line)) cmd_exec("down");
-		for (int i = 0; i < v_list.size(); i++) if (v_list.at(i) == cui_s_line) cui_v_line = i;
+		for (int i = 0; i < (int)v_list.size(); i++) if (v_list.at(i) == cui_s_line) cui_v_line = i;
 	}
 
 	cui_delta = 0;
@@ -317,23 +365,24 @@ void cui_normal_paint()
 	int last_string = 0;
 	if (v_list.size() > 0) 
 	{
-		for (int l = 0; l < v_list.size(); l++)
+		for (int l = 0; l < (int)v_list.size(); l++)
 		{
 			if (l - cui_delta >= cui_h - 2) break;
 			if (l >= cui_delta)    
 			{
 				const noaftodo_entry& entry = t_list.at(v_list.at(l));
+				const uint8_t state = states.at(v_list.at(l));
 				
 				if (l == cui_v_line) attron(A_STANDOUT);
-				if (entry.completed) attron(COLOR_PAIR(CUI_CP_GREEN_ENTRY) | A_BOLD);	// a completed entry
-				else if (entry.due <= ti_to_long("a0d")) attron(COLOR_PAIR(CUI_CP_RED_ENTRY) | A_BOLD);	// a failed entry
-				else if (entry.due <= ti_to_long("a1d")) attron(COLOR_PAIR(CUI_CP_YELLOW_ENTRY) | A_BOLD);	// an upcoming entry
+				if (state == LI_S_COMPLETE) attron(COLOR_PAIR(CUI_CP_GREEN_ENTRY) | A_BOLD);	// a completed entry
+				else if (state == LI_S_FAILED) attron(COLOR_PAIR(CUI_CP_RED_ENTRY) | A_BOLD);	// a failed entry
+				else if (state == LI_S_COMING) attron(COLOR_PAIR(CUI_CP_YELLOW_ENTRY) | A_BOLD);	// an upcoming entry
 
 				x = 0;
 				move(l - cui_delta + 1, x);
 				for (int i = 0; i < cui_w; i++) addch(' ');
 
-				for (int coln = 0; coln < cols.length(); coln++)
+				for (int coln = 0; coln < (int)cols.length(); coln++)
 				{
 					try
 					{
@@ -343,13 +392,13 @@ void cui_normal_paint()
 						const int w = cui_columns.at(col).width(cui_w, cui_w - x, cols.length());
 						addstr((cui_columns.at(col).contents(entry, v_list.at(l))).c_str());
 
-						if (coln < cols.length() - 1) if (x + w < cui_w)
+						if (coln < (int)cols.length() - 1) if (x + w < cui_w)
 						{
 							move(l - cui_delta + 1, x + w);
 							addstr((" " + conf_get_cvar("charset.row_separator") + " ").c_str());
 						}
 						x += w + 3;
-					} catch (out_of_range e) {}
+					} catch (const out_of_range& e) {}
 				}
 
 				move(l - cui_delta + 1, cui_w - 1);
@@ -365,7 +414,7 @@ void cui_normal_paint()
 
 	cui_status = 	((tag_filter == CUI_TAG_ALL) ?
 				"All lists" :
-				("List " + to_string(tag_filter) + (((tag_filter < t_tags.size()) && (t_tags.at(tag_filter) != to_string(tag_filter))) ? (": " + t_tags.at(tag_filter)) : ""))) +
+				("List " + to_string(tag_filter) + (((tag_filter < (int)t_tags.size()) && (t_tags.at(tag_filter) != to_string(tag_filter))) ? (": " + t_tags.at(tag_filter)) : ""))) +
 			" " + conf_get_cvar("charset.status_separator") + " " +
 			string((filter & CUI_FILTER_UNCAT) ? "U" : "_") +
 			string((filter & CUI_FILTER_COMPLETE) ? "V" : "_") +
@@ -463,7 +512,7 @@ void cui_details_paint()
 	// Title
 	const noaftodo_entry& entry = t_list.at(cui_s_line);
 	move(4, 5);
-	addstr(entry.title.c_str());
+	addstr(string(entry.title).c_str());
 
 	for (int i = 4; i < cui_w - 4; i++)
 	{
@@ -474,7 +523,7 @@ void cui_details_paint()
 	move(7, 5);
 	
 	string tag = "";
-	if (entry.tag < t_tags.size()) if (t_tags.at(entry.tag) != to_string(entry.tag))
+	if (entry.tag < (int)t_tags.size()) if (t_tags.at(entry.tag) != to_string(entry.tag))
 		tag = ": " + t_tags.at(entry.tag);
 
 	addstr((ti_f_str(entry.due) +
@@ -490,10 +539,10 @@ void cui_details_paint()
 
 	// draw description
 	// we want text wrapping here
-	wstring desc = w_converter.from_bytes(entry.description);
+	wstring desc = w_converter.from_bytes(string(li_description(entry)));
 	int x = 5;
 	int y = 10 + tdelta;
-	for (int i = 0; i < desc.length(); i++)
+	for (int i = 0; i < (int)desc.length(); i++)
 	{
 		if (x == cui_w - 5)
 		{
@@ -572,7 +621,7 @@ void cui_command_input(const wchar_t& key)
 			if (cui_commands[cui_commands.size() - 1] != w_converter.from_bytes(""))
 			{
 				cmd_exec(w_converter.to_bytes(cui_commands[cui_commands.size() - 1]));
-				if (cui_command_index != cui_commands.size() - 1)
+				if (cui_command_index != (int)cui_commands.size() - 1)
 				{
 					wstring temp = cui_commands[cui_commands.size() - 1];
 					cui_commands[cui_command_index] = cui_commands[cui_commands.size() - 1];
@@ -582,6 +631,7 @@ void cui_command_input(const wchar_t& key)
 				cui_commands.push_back(w_converter.from_bytes(""));
 				cui_command_index = cui_commands.size() - 1;
 			}
+			// fall through - the command line is cleared as on escape
 		case 27:
 			cui_commands[cui_commands.size() - 1] = L"";
 			if (cui_mode == CUI_MODE_COMMAND) cui_set_mode(CUI_MODE_NORMAL);
@@ -589,7 +639,7 @@ void cui_command_input(const wchar_t& key)
 			break;
 		case 127: case KEY_BACKSPACE: // 127 is for, e.g., xfce4-terminal
 						// KEY_BACKSPACE - e.g., alacritty
-			if (cui_command_index != cui_commands.size() - 1)
+			if (cui_command_index != (int)cui_commands.size() - 1)
 			{
 				wstring temp = cui_commands[cui_commands.size() - 1];
 				cui_commands[cui_commands.size() - 1] = cui_commands[cui_command_index];
@@ -605,7 +655,7 @@ void cui_command_input(const wchar_t& key)
 			}
 			break;
 		case KEY_DC:
-			if (cui_command_index != cui_commands.size() - 1)
+			if (cui_command_index != (int)cui_commands.size() - 1)
 			{
 				wstring temp = cui_commands[cui_commands.size() - 1];
 				cui_commands[cui_commands.size() - 1] = cui_commands[cui_command_index];
@@ -614,14 +664,14 @@ void cui_command_input(const wchar_t& key)
 				cui_command_index = cui_commands.size() - 1;
 			}
 
-			if (cui_command_cursor < cui_commands[cui_commands.size() - 1].length())
+			if (cui_command_cursor < (int)cui_commands[cui_commands.size() - 1].length())
 				cui_commands[cui_commands.size() - 1] = cui_commands[cui_commands.size() - 1].substr(0, cui_command_cursor) + cui_commands[cui_commands.size() - 1].substr(cui_command_cursor + 1, cui_commands[cui_commands.size() - 1].length() - cui_command_cursor - 1);
 			break;
 		case KEY_LEFT:
 			if (cui_command_cursor > 0) cui_command_cursor--;
 			break;
 		case KEY_RIGHT:
-			if (cui_command_cursor < cui_commands[cui_commands.size() - 1].length()) cui_command_cursor++;
+			if (cui_command_cursor < (int)cui_commands[cui_commands.size() - 1].length()) cui_command_cursor++;
 			break;
 		case KEY_UP:
 			// go up the history
@@ -632,20 +682,20 @@ void cui_command_input(const wchar_t& key)
 				cui_commands[cui_commands.size() - 1] = cui_commands[cui_command_index - 1];
 				cui_commands[cui_command_index - 1] = temp;
 				cui_command_index--;
-				if (cui_command_cursor > cui_commands[cui_commands.size() - 1].length())
+				if (cui_command_cursor > (int)cui_commands[cui_commands.size() - 1].length())
 					cui_command_cursor = cui_commands[cui_commands.size() - 1].length();
 			}
 			break;
 		case KEY_DOWN:
 			// go down the history
-			if (cui_command_index < cui_commands.size() - 1)
+			if (cui_command_index < (int)cui_commands.size() - 1)
 			{
 				wstring temp = cui_commands[cui_command_index];
 				cui_commands[cui_command_index] = cui_commands[cui_commands.size() - 1];
 				cui_commands[cui_commands.size() - 1] = cui_commands[cui_command_index + 1];
 				cui_commands[cui_command_index + 1] = temp;
 				cui_command_index++;
-				if (cui_command_cursor > cui_commands[cui_commands.size() - 1].length())
+				if (cui_command_cursor > (int)cui_commands[cui_commands.size() - 1].length())
 					cui_command_cursor = cui_commands[cui_commands.size() - 1].length();
 			}	
 			break;
@@ -656,7 +706,7 @@ void cui_command_input(const wchar_t& key)
 			cui_command_cursor = cui_commands[cui_commands.size() - 1].length();
 			break;
 		default:
-			if (cui_command_index != cui_commands.size() - 1)
+			if (cui_command_index != (int)cui_commands.size() - 1)
 			{
 				wstring temp = cui_commands[cui_commands.size() - 1];
 				cui_commands[cui_commands.size() - 1] = cui_commands[cui_command_index];
@@ -729,7 +779,7 @@ void cui_help_paint()
 	for (char* c = &_binary_doc_doc_gen_start; c < &_binary_doc_doc_gen_end; c++)
 		cui_help += string(1, *c);
 
-	for (int i = 0; i < cui_help.length(); i++)
+	for (int i = 0; i < (int)cui_help.length(); i++)
 	{
 		if (x == cui_w - 5)
 		{
@@ -788,7 +838,7 @@ void cui_help_input(const wchar_t& key)
 
 void cui_filter_history()
 {
-	for (int i = 0; i < cui_commands.size() - 1; i++)
+	for (int i = 0; i < (int)cui_commands.size() - 1; i++)
 		if (cui_commands[i] == w_converter.from_bytes("")) 
 		{
 			cui_commands.erase(cui_commands.begin() + i);
@@ -43,16 +43,17 @@ constexpr int CUI_MODE_COMMAND = 0b10;
 constexpr int CUI_MODE_HELP = 0b100;
 
 // filters
-constexpr int CUI_FILTER_UNCAT = 0b1; // uncategorized
-constexpr int CUI_FILTER_COMPLETE = 0b10; // complete
-constexpr int CUI_FILTER_COMING = 0b100; // upcoming
-constexpr int CUI_FILTER_FAILED = 0b1000; // failed
+constexpr int CUI_FILTER_UNCAT = LI_S_UNCAT; // uncategorized
+constexpr int CUI_FILTER_COMPLETE = LI_S_COMPLETE; // complete
+constexpr int CUI_FILTER_COMING = LI_S_COMING; // upcoming
+constexpr int CUI_FILTER_FAILED = LI_S_FAILED; // failed
 
 constexpr int CUI_TAG_ALL = -1;
 
 // current mode
 extern int cui_mode;
 extern std::stack<int> cui_prev_modes;
+extern bool cui_active;		// the console UI runs: there are modes to switch to
 
 // binds
 extern std::vector<cui_bind_s> binds;
@@ -64,7 +65,8 @@ extern int cui_w, cui_h;
 extern std::string cui_status;
 
 // normal mode data
-extern int cui_s_line;
+extern int cui_s_line;		// position of the selected entry
+extern uint64_t cui_s_id;	// ID of the selected entry - survives sorting and reloads
 extern int cui_delta;
 extern int cui_numbuffer;
 
@@ -83,6 +85,9 @@ void cui_set_mode(const int& mode);
 void cui_bind(const cui_bind_s& bind);
 void cui_bind(const wchar_t& key, const std::string& command, const int& mode, const bool& autoexec);
 
+void cui_select(const int& entryID);
+void cui_sync_selection();
+
 bool cui_is_visible(const int& entryID);
 
 // mode-specific painters and input handlers
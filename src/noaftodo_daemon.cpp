@@ -1,175 +1,1074 @@
 #include "noaftodo_daemon.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <ctime>
 #include <fstream>
+#include <iterator>
+#include <mutex>
 #include <string>
+#include <unordered_set>
+#include <fcntl.h>
 #include <mqueue.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 
 #include "noaftodo.h"
 #include "noaftodo_cmd.h"
 #include "noaftodo_config.h"
+#include "noaftodo_exec.h"
 #include "noaftodo_output.h"
+#include "noaftodo_server.h"
+#include "noaftodo_stats.h"
 #include "noaftodo_time.h"
 
 using namespace std;
 
 int da_interval = 1;
 
-vector<noaftodo_entry> da_cache;
-long da_cached_time = 0;
+// the list in use. da_swap() puts another one in its place
+static da_context_s da_ctx;
 
-void da_run()
+unordered_map<uint64_t, da_cached_s>& da_cache = da_ctx.cache;
+shared_ptr<li_pool_s>& da_cache_pool = da_ctx.cache_pool;
+ti_snapshot_s& da_cached_time = da_ctx.cached_time;
+
+vector<pair<time_t, uint64_t>>& da_deadlines = da_ctx.deadlines;
+
+map<pair<string, bool>, da_batch_s>& da_batches = da_ctx.batches;
+
+// t_list is the list file with the changes from the messages applied.
+// Until it's read again after they stop to add up, messages are ignored
+static bool& da_synced = da_ctx.synced;
+static vector<da_message_s>& da_ahead = da_ctx.ahead;		// changes on top of a snapshot that is being written
+static unordered_set<uint64_t>& da_touched = da_ctx.touched;	// tasks the applied changes touched
+
+// server mode: the daemon makes the changes itself, see noaftodo_server.h.
+// The list writer reads it too (da_send()): it's changed only while the writer is stopped
+static bool& da_server = da_ctx.server;
+static bool& da_rediff = da_ctx.rediff;			// a bulk edit: every task has to be looked at
+static uint32_t da_pass = 0;			// full diffs so far, of all the lists
+
+// the state file, see DA_STATE_SUFFIX
+static int& da_state_fd = da_ctx.state_fd;
+static size_t& da_state_size = da_ctx.state_size;
+static size_t& da_state_appended = da_ctx.state_appended;
+static unordered_set<uint64_t>& da_state_dirty = da_ctx.state_dirty;
+static bool& da_state_changed = da_ctx.state_changed;
+
+// the clock the waits are measured by. time() can lag behind it
+// by a few ms, and the daemon would spin until it catches up
+static time_t da_time()
 {
-	// init cache
-	if (da_check_lockfile())
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return now.tv_sec;
+}
+
+// run the action of the kind ("failed", "new", ...) for a task,
+// or add the task to the batch of its kind
+static void da_action(const string& kind, const noaftodo_entry& li_entry, const bool& renotify = false)
+{
+	da_state_changed = true;
+
+	const string kinds = " " + conf_get_cvar("batch_actions") + " ";
+	if (kinds.find(" " + kind + " ") == string::npos)
 	{
-		log("Lockfile " + string(DA_LOCK_FILE) + " exists. If daemon is not running, you can delete it or run noaftodo -k.");
+		st_count("actions." + kind);
+		cmd_exec(format_str(conf_get_cvar("on_task_" + kind + "_action"), li_entry, renotify));
 		return;
+	}
+
+	da_batch_s& batch = da_batches[{ kind, renotify }];
+	// the clock is read in whole seconds: the batch is open for at least "batch_window" of them
+	const int window = conf_get_cvar_int("batch_window");
+	if (batch.entries.empty()) batch.deadline = da_time() + window + ((window > 0) ? 1 : 0);
+
+	// the entry can outlive its list generation
+	noaftodo_entry copy = li_entry;
+	batch.strings.push_back(string(li_entry.title));
+	copy.title = batch.strings.back();
+	if (batch.entries.empty())
+	{
+		batch.strings.push_back(string(li_description(li_entry)));
+		copy.description = batch.strings.back();
+	} else copy.description = "";
+	copy.desc_offset = -1;
+
+	batch.entries.push_back(copy);
+}
+
+// run the actions for the batches that are due. All - for all of them
+static void da_batches_run(const bool& all)
+{
+	const time_t now = da_time();
+
+	for (auto it = da_batches.begin(); it != da_batches.end(); )
+	{
+		const string& kind = it->first.first;
+		const bool& renotify = it->first.second;
+		const da_batch_s& batch = it->second;
+
+		if (!all && (batch.deadline > now))
+		{
+			it++;
+			continue;
+		}
+
+		if (batch.entries.size() == 1)
+		{
+			st_count("actions." + kind);
+			cmd_exec(format_str(conf_get_cvar("on_task_" + kind + "_action"), batch.entries.front(), renotify));
+		} else {
+			const string action = conf_get_cvar("on_tasks_" + kind + "_action");
+
+			// no batch action - one action per task
+			if (action == "")
+				for (const auto& li_entry : batch.entries)
+				{
+					st_count("actions." + kind);
+					cmd_exec(format_str(conf_get_cvar("on_task_" + kind + "_action"), li_entry, renotify));
+				}
+			else
+			{
+				st_count("actions." + kind + ".batch");
+				cmd_exec(format_str(action, batch.entries, renotify));
+			}
+		}
+
+		it = da_batches.erase(it);
+	}
+}
+
+// next state change of a cached task: coming a day before its due, failed at its due.
+// Completed and failed tasks don't change by themselves. Without "heap" the
+// deadline is only appended to da_deadlines: the caller makes it a heap
+static void da_schedule(da_cached_s& cached, const uint8_t& state, const time_t& now, const bool& heap = true)
+{
+	st_count("daemon.scheduled");
+
+	// the state file has them too
+	const uint8_t old_state = cached.state;
+	const time_t old_deadline = cached.deadline;
+
+	cached.state = state;
+	cached.deadline = 0;
+	if ((state == LI_S_UNCAT) || (state == LI_S_COMING))
+	{
+		const long due = (state == LI_S_UNCAT) ? ti_from_minutes(ti_to_minutes(cached.entry.due) - 24 * 60) : cached.entry.due;
+
+		// a due that does not exist in local time (DST) is looked at every minute
+		time_t deadline = ti_to_time(due);
+		if (deadline <= now) deadline = now + 60 - now % 60;
+
+		// the deadline it had before stays in the heap until it's popped
+		cached.deadline = deadline;
+		da_deadlines.push_back({ deadline, cached.entry.id });
+		if (heap) push_heap(da_deadlines.begin(), da_deadlines.end(), greater<>());
+	}
+
+	if ((cached.state != old_state) || (cached.deadline != old_deadline)) da_state_dirty.insert(cached.entry.id);
+}
+
+// run the actions for the tasks whose deadlines passed by li_time
+static void da_transitions()
+{
+	const time_t now = li_time.time;
+
+	while (!da_deadlines.empty() && (da_deadlines.front().first <= now))
+	{
+		const auto deadline = da_deadlines.front();
+		const uint64_t id = deadline.second;
+		pop_heap(da_deadlines.begin(), da_deadlines.end(), greater<>());
+		da_deadlines.pop_back();
+
+		const auto cached = da_cache.find(id);
+		if ((cached == da_cache.end()) || (cached->second.deadline != deadline.first)) continue;
+		cached->second.deadline = 0;
+
+		const int entryID = li_find(id);
+		if (entryID == -1) continue;
+
+		const noaftodo_entry li_entry = t_list.at(entryID);
+		const uint8_t state = li_cols.state.at(entryID);
+
+		if (state == LI_S_FAILED)
+			da_action("failed", li_entry);
+		else if (state == LI_S_COMING)
+			da_action("coming", li_entry);
+
+		da_schedule(cached->second, state, now);
+	}
+}
+
+#ifdef __linux__
+// watch the list file directory: files are replaced by renames, so
+// a watch on the file itself would be lost after the first save.
+// -1 if inotify is not available
+static int da_watch()
+{
+	const size_t slash = li_filename.rfind('/');
+	const string dir = (slash == string::npos) ? "." : ((slash == 0) ? "/" : li_filename.substr(0, slash));
+
+	const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd == -1) return -1;
+
+	if (inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+#endif
+
+// what the deadline of a task and its record in the state file depend on,
+// besides its completion and list. Descriptions left in the list file count by length
+static uint64_t da_fingerprint(const noaftodo_entry& li_entry)
+{
+	const hash<string_view> hasher;
+	uint64_t fingerprint = hasher(li_entry.title);
+
+	const uint64_t parts[] = {
+		(li_entry.desc_offset == -1) ? hasher(li_entry.description) : li_entry.desc_length,
+		(uint64_t)li_entry.due };
+	for (const auto& part : parts)
+		fingerprint ^= part + 0x9e3779b97f4a7c15ULL + (fingerprint << 6) + (fingerprint >> 2);
+
+	// 0 is "none yet"
+	return (fingerprint == 0) ? 1 : fingerprint;
+}
+
+// run the actions for what changed in a task since it was cached and cache it.
+// Task states are the ones at li_time. Full - da_diff() looks at every task,
+// the deadlines are put in the heap after
+static void da_diff_entry(const int& entryID, const bool& first, const bool& full = false)
+{
+	const noaftodo_entry e1 = t_list.at(entryID);
+	const uint8_t state = li_cols.state.at(entryID);
+	const uint64_t fingerprint = da_fingerprint(e1);
+	auto cached = da_cache.find(e1.id);
+
+	if (cached == da_cache.end())
+	{	// add to cache
+		cached = da_cache.emplace(e1.id, da_cached_s { e1, fingerprint }).first;
+		da_state_dirty.insert(e1.id);
+
+		if (state == LI_S_COMPLETE)
+			da_action("completed", e1, first);
+		else if (state == LI_S_FAILED)
+			da_action("failed", e1, first);
+		else if (state == LI_S_COMING)
+			da_action("coming", e1, first);
+		else if (!first)
+			da_action("new", e1);
+
+		da_schedule(cached->second, state, li_time.time, !full);
 	} else {
-		da_lock();
+		const noaftodo_entry e2 = cached->second.entry;
+
+		if (e1.completed != e2.completed)
+		{
+			if (state == LI_S_COMPLETE)
+				da_action("completed", e1);
+			else if (state == LI_S_FAILED)
+				da_action("failed", e1);
+			else if (state == LI_S_COMING)
+				da_action("coming", e1);
+			else
+				da_action("uncompleted", e1);
+		} else if (state != LI_S_COMPLETE)
+		{
+			if (state == LI_S_FAILED)
+			{
+				if (e1.due > da_cached_time.now)
+					da_action("failed", e1);
+			} else if (state == LI_S_COMING)
+			{
+				if (e1.due > da_cached_time.coming)
+					da_action("coming", e1);
+			}
+		}
+
+		const bool changed = (fingerprint != cached->second.fingerprint);
+		if (changed || (e1.completed != e2.completed) || (e1.tag != e2.tag))
+			da_state_dirty.insert(e1.id);
+
+		cached->second.entry = e1;
+		cached->second.fingerprint = fingerprint;
+
+		// the deadline is taken again only if the due or the state changed
+		if (changed || (state != cached->second.state) || ((cached->second.deadline != 0) && (cached->second.deadline <= li_time.time)))
+			da_schedule(cached->second, state, li_time.time, !full);
+		else if (full && (cached->second.deadline != 0))
+			da_deadlines.push_back({ cached->second.deadline, e1.id });
 	}
 
-	da_cache.clear();
-	li_autosave = false;
+	cached->second.pass = da_pass;
+}
 
-	log("Opening a message queue...");
-	mq_attr attr;
-	attr.mq_maxmsg = 10;
-	attr.mq_msgsize = DA_MSGSIZE;
-	attr.mq_flags = 0;
-	mqd_t mq = mq_open(DA_MQ_NAME, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR, &attr);
+// run the action for a cached task that is not in the list anymore.
+// Returns the next cache entry
+static unordered_map<uint64_t, da_cached_s>::iterator da_diff_removed(const unordered_map<uint64_t, da_cached_s>::iterator& cached)
+{
+	// the description might be in the previous list file
+	noaftodo_entry removed = cached->second.entry;
+	removed.description = li_description(removed, *da_cache_pool);
+	removed.desc_offset = -1;
 
-	if (mq == -1)
+	da_action("removed", removed);
+	da_state_dirty.insert(cached->first);
+	return da_cache.erase(cached);
+}
+
+// run the actions for the changes since the last tick and update the cache.
+// One pass over the list, one over the cache
+static void da_diff(const bool& first)
+{
+	da_pass++;
+	da_deadlines.clear();
+
+	for (int i = 0; i < (int)t_list.size(); i++) da_diff_entry(i, first, true);
+	make_heap(da_deadlines.begin(), da_deadlines.end(), greater<>());
+
+	// the tasks the pass did not see are gone
+	for (auto cached = da_cache.begin(); cached != da_cache.end(); )
 	{
-		log("Failed!", LP_ERROR);
+		if (cached->second.pass != da_pass) cached = da_diff_removed(cached);
+		else cached++;
+	}
+}
+
+// same, only for the tasks the messages changed
+static void da_diff_touched()
+{
+	for (const auto& id : da_touched)
+	{
+		const int entryID = li_find(id);
+		if (entryID != -1) da_diff_entry(entryID, false);
+		else
+		{
+			const auto cached = da_cache.find(id);
+			if (cached != da_cache.end()) da_diff_removed(cached);
+		}
+	}
+
+	da_touched.clear();
+}
+
+template <typename T>
+static void da_state_put(string& out, const T& value)
+{
+	out.append((const char*)&value, sizeof(value));
+}
+
+template <typename T>
+static bool da_state_get(const string& data, size_t& pos, T& value)
+{
+	if (pos + sizeof(value) > data.length()) return false;
+
+	memcpy(&value, data.data() + pos, sizeof(value));
+	pos += sizeof(value);
+	return true;
+}
+
+static string da_state_filename()
+{
+	const size_t slash = li_filename.rfind('/');
+	if (slash == string::npos) return "." + li_filename + DA_STATE_SUFFIX;
+
+	return li_filename.substr(0, slash + 1) + "." + li_filename.substr(slash + 1) + DA_STATE_SUFFIX;
+}
+
+static void da_state_time(string& out)
+{
+	out += DA_STATE_TIME;
+	da_state_put<int64_t>(out, da_cached_time.time);
+	da_state_put<int64_t>(out, da_cached_time.now);
+	da_state_put<int64_t>(out, da_cached_time.coming);
+}
+
+// the record of a cached entry, or of the entry that's not cached anymore
+static void da_state_entry(string& out, const uint64_t& id)
+{
+	const auto cached = da_cache.find(id);
+	if (cached == da_cache.end())
+	{
+		out += DA_STATE_ERASE;
+		da_state_put<uint64_t>(out, id);
 		return;
 	}
-	log("OK");
 
-	cmd_exec(format_str(conf_get_cvar("on_daemon_launch_action"), {}));
+	const noaftodo_entry& li_entry = cached->second.entry;
+	const uint16_t length = min<size_t>(li_entry.title.length(), UINT16_MAX);
+
+	out += DA_STATE_SET;
+	da_state_put<uint64_t>(out, id);
+	da_state_put<int64_t>(out, li_entry.due);
+	da_state_put<int32_t>(out, li_entry.tag);
+	da_state_put<uint8_t>(out, li_entry.completed);
+	da_state_put<uint64_t>(out, cached->second.fingerprint);
+	da_state_put<uint8_t>(out, cached->second.state);
+	da_state_put<int64_t>(out, cached->second.deadline);
+	da_state_put<uint16_t>(out, length);
+	out.append(li_entry.title.data(), length);
+	st_count("daemon.state_records");
+}
 
-	bool running = true;
-	timespec tout;
-	bool first = true;
-	while (running)
+// write the whole cache to a new state file and append to it from now on
+static void da_state_compact()
+{
+	string out(DA_STATE_MAGIC, sizeof(DA_STATE_MAGIC));
+	da_state_time(out);
+	for (const auto& cached : da_cache) da_state_entry(out, cached.first);
+
+	const string filename = da_state_filename();
+
+	if (da_state_fd != -1) close(da_state_fd);
+	da_state_fd = -1;
+
+	const int fd = li_write_atomic(filename, out, {}, S_IRUSR | S_IWUSR) ? open(filename.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC) : -1;
+	if (fd == -1)
 	{
-		// update cache
-		li_load();
-		for (int i = 0; i < t_list.size(); i++)
+		log("Can't write " + filename, LP_ERROR);
+		return;
+	}
+
+	da_state_fd = fd;
+	da_state_size = out.length();
+	da_state_appended = 0;
+}
+
+// write what changed in the cache since the last time
+static void da_state_save()
+{
+	if (!da_state_changed && da_state_dirty.empty()) return;
+
+	if ((da_state_fd == -1) || (da_state_appended > max(DA_STATE_SLACK * da_state_size, DA_STATE_MIN)))
+		da_state_compact();
+	else
+	{
+		string out;
+		for (const auto& id : da_state_dirty) da_state_entry(out, id);
+		da_state_time(out);
+
+		// a record cut short by a crash is dropped on load, along with the ones after it.
+		// Synced, like the journal: a lost record means actions run again
+		if ((write(da_state_fd, out.data(), out.length()) == (ssize_t)out.length()) && (fdatasync(da_state_fd) == 0))
+			da_state_appended += out.length();
+		else da_state_compact();
+	}
+
+	da_state_dirty.clear();
+	da_state_changed = false;
+}
+
+// fill the cache from the state file. False if there's none
+static bool da_state_load()
+{
+	ifstream ifile(da_state_filename(), ios::in | ios::binary);
+	if (!ifile.good()) return false;
+	const string data((istreambuf_iterator<char>(ifile)), istreambuf_iterator<char>());
+
+	if ((data.length() < sizeof(DA_STATE_MAGIC)) || (memcmp(data.data(), DA_STATE_MAGIC, sizeof(DA_STATE_MAGIC)) != 0))
+	{
+		log("State file " + da_state_filename() + " is damaged. Ignoring it", LP_ERROR);
+		return false;
+	}
+
+	// titles of the cached entries live in a pool of their own, like the lists of a sharded list
+	auto pool = make_shared<li_pool_s>();
+	swap(li_pool, pool);
+
+	bool timed = false;
+	size_t pos = sizeof(DA_STATE_MAGIC);
+	while (pos < data.length())
+	{
+		const size_t start = pos;
+		const char op = data.at(pos++);
+		bool whole = false;
+
+		if (op == DA_STATE_TIME)
+		{
+			int64_t time, now, coming;
+			whole = da_state_get(data, pos, time) && da_state_get(data, pos, now) && da_state_get(data, pos, coming);
+			if (whole)
+			{
+				da_cached_time.time = time;
+				da_cached_time.now = now;
+				da_cached_time.coming = coming;
+				timed = true;
+			}
+		} else if (op == DA_STATE_SET)
+		{
+			uint64_t id, fingerprint;
+			int64_t due, deadline;
+			int32_t tag;
+			uint8_t completed, state;
+			uint16_t length;
+			whole = da_state_get(data, pos, id) && da_state_get(data, pos, due) && da_state_get(data, pos, tag) &&
+				da_state_get(data, pos, completed) && da_state_get(data, pos, fingerprint) && da_state_get(data, pos, state) &&
+				da_state_get(data, pos, deadline) && da_state_get(data, pos, length) && (pos + length <= data.length());
+			if (whole)
+			{
+				// the first diff takes again only the deadlines of the tasks that changed
+				da_cached_s& cached = da_cache[id];
+				cached.entry = { completed != 0, (long)due, li_intern(string_view(data.data() + pos, length)), "", tag, id };
+				cached.fingerprint = fingerprint;
+				cached.state = state;
+				cached.deadline = deadline;
+				pos += length;
+			}
+		} else if (op == DA_STATE_ERASE)
+		{
+			uint64_t id;
+			whole = da_state_get(data, pos, id);
+			if (whole) da_cache.erase(id);
+		}
+
+		if (!whole)
+		{
+			pos = start;
+			break;
+		}
+	}
+
+	swap(li_pool, pool);
+	da_cache_pool = pool;
+
+	if (!timed)
+	{
+		da_cache.clear();
+		return false;
+	}
+
+	log("Resumed from " + da_state_filename() + ", " + to_string(da_cache.size()) + " tasks cached");
+
+	// appended to as it is. A record cut short would be in the way of the ones after it
+	if (pos == data.length())
+	{
+		da_state_fd = open(da_state_filename().c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+		da_state_size = data.length();
+		da_state_appended = 0;
+	}
+
+	return true;
+}
+
+noaftodo_entry da_entry(const da_message_s& message)
+{
+	return { message.completed != 0, (long)message.due,
+		string_view(message.strings, message.lengths[0]),
+		string_view(message.strings + message.lengths[0], message.lengths[1]),
+		message.tag, message.id };
+}
+
+// apply a change a message tells about. False if it does not follow
+// the changes the daemon has: the list has to be read again
+static bool da_apply(const da_message_s& message)
+{
+	if (message.truncated || (message.lengths[0] + message.lengths[1] > sizeof(message.strings))) return false;
+
+	// made after a snapshot that is being written. It's applied once the daemon gets it
+	if (message.generation == li_generation + 1)
+	{
+		da_ahead.push_back(message);
+		return true;
+	}
+
+	if ((message.generation != li_generation) || (message.changes != li_changes + 1)) return false;
+
+	if (!li_apply(message.op, da_entry(message))) return false;
+
+	if (message.op != LI_J_RENAME) da_touched.insert(message.id);
+	return true;
+}
+
+// a list file was written. False if it's not the list the daemon has
+static bool da_saved(const da_message_s& message)
+{
+	if (message.lengths[0] > sizeof(message.strings)) return false;
+	const string filename(message.strings, message.lengths[0]);
+
+	if (message.base == li_generation)
+	{
+		if (message.generation == li_generation)
+		{	// journal: some of the changes on top of this generation
+			if (message.changes > li_changes) return false;
+			li_saved(filename, message.file);
+		} else {
+			// a snapshot has every change made to this generation
+			if ((message.changes != li_changes) || (message.format != li_format) || (message.sharded != li_sharded)) return false;
+
+			li_saved(filename, message.file);
+			li_generation = message.generation;
+			li_changes = 0;
+
+			vector<da_message_s> ahead;
+			ahead.swap(da_ahead);
+			for (const auto& change : ahead)
+				if (!da_apply(change)) return false;
+		}
+	} else if ((message.generation == li_generation) && (message.base == li_generation - 1))
+		li_saved(filename, message.file);	// another file of the snapshot taken already
+	else return false;
+
+	return true;
+}
+
+// a change the server made: its actions are run on the next tick
+static void da_changed(const da_message_s& message)
+{
+	if (message.op == DA_OP_RELOAD) da_rediff = true;
+	else if (message.op != LI_J_RENAME) da_touched.insert(message.id);
+
+	sv_feed(message);
+}
+
+// the stats of the daemon, for the list in use
+static void da_stats_write()
+{
+	if (!st_write(da_name(DA_STATS_FILE))) log("Can't write " + da_name(DA_STATS_FILE), LP_ERROR);
+}
+
+// handle the messages that came since the last tick
+static void da_messages(const vector<da_message_s>& messages, bool& running)
+{
+	const bool synced = da_synced;
+	bool foreign = false;
+
+	for (const auto& message : messages)
+	{
+		char op = message.op;
+
+		// older clients only tell that the list changed
+		if ((message.version == 0) && (op != DA_OP_KILL) && (op != DA_OP_RENOTIFY)) op = DA_OP_RELOAD;
+
+		// the server does not read the list file, and writes over it
+		if (da_server && (op != DA_OP_KILL) && (op != DA_OP_RENOTIFY))
+		{
+			foreign = true;
+			continue;
+		}
+
+		switch (op)
 		{
-			bool cached = false;
-			int cached_id = -1;
-			for (int j = 0; j < da_cache.size(); j++)
-				if (da_cache.at(j).sim(t_list.at(i)))
+			case DA_OP_KILL:
+				log(string(1, op));
+				running = false;
+				break;
+			case DA_OP_RENOTIFY:
+			{
+				log(string(1, op));
+				li_update_states(ti_snapshot());
+				const vector<uint8_t>& states = li_cols.state;
+
+				for (int i = 0; i < (int)t_list.size(); i++)
 				{
-					cached = true;
-					cached_id = j;
+					const noaftodo_entry e1 = t_list.at(i);
+					if (states.at(i) == LI_S_COMPLETE)
+						da_action("completed", e1, true);
+					else if (states.at(i) == LI_S_FAILED)
+						da_action("failed", e1, true);
+					else if (states.at(i) == LI_S_COMING)
+						da_action("coming", e1, true);
 				}
+				break;
+			}
+			case DA_OP_RELOAD:
+				da_synced = false;
+				break;
+			case DA_OP_STATS:
+				log(string(1, op));
+				da_stats_write();
+				break;
+			case DA_OP_SAVED:
+				if (da_synced) da_synced = da_saved(message);
+				break;
+			default:
+				if (da_synced) da_synced = da_apply(message);
+		}
+	}
 
-			const noaftodo_entry e1 = t_list.at(i);
+	if (foreign) log("The list was changed by a program that is not a client of the daemon. The change will be lost", LP_ERROR);
 
-			if (!cached)
-			{	// add to cache
-				da_cache.push_back(t_list.at(i));
+	if (synced && !da_synced)
+	{
+		log("Lost track of the list changes. Reading the list file again");
+		da_ahead.clear();
+	}
+}
 
-				if (e1.completed)
-					cmd_exec(format_str(conf_get_cvar("on_task_completed_action"), e1, first));
-				else if (e1.due <= ti_to_long("a0d"))
-					cmd_exec(format_str(conf_get_cvar("on_task_failed_action"), e1, first));
-				else if (e1.due <= ti_to_long("a1d"))
-					cmd_exec(format_str(conf_get_cvar("on_task_coming_action"), e1, first));
-				else if (!first)
-					cmd_exec(format_str(conf_get_cvar("on_task_new_action"), e1));
-			} else {
-				const noaftodo_entry e2 = da_cache.at(cached_id);
+// a list the daemon serves. While the daemon works with another list,
+// the state of this one is kept here
+struct da_list_s
+{
+	li_context_s list;
+	da_context_s daemon;
+	sv_context_s server;
 
-				if (e1.completed != e2.completed)
-				{
-					if (e1.completed)
-						cmd_exec(format_str(conf_get_cvar("on_task_completed_action"), e1));
-					else if (e1.due <= ti_to_long("a0d"))
-						cmd_exec(format_str(conf_get_cvar("on_task_failed_action"), e1));
-					else if (e1.due <= ti_to_long("a1d"))\
-						cmd_exec(format_str(conf_get_cvar("on_task_coming_action"), e1));
-					else
-						cmd_exec(format_str(conf_get_cvar("on_task_uncompleted_action"), e1));
-				} else if (!e1.completed)
+	mqd_t mq = (mqd_t)-1;
+	int watch_fd = -1;
+	bool first = true;			// nothing is cached yet
+	vector<da_message_s> received;		// taken from the queue, not handled yet
+};
+
+#ifdef __linux__
+// sleep until a message comes, a list changes or it's "wake" time
+static void da_wait(vector<da_list_s>& lists, const time_t& wake)
+{
+	// the list file, its journal and its list files all start with its name
+	vector<string> names;
+	for (const auto& list : lists)
+	{
+		const string& filename = list.list.filename;
+		const size_t slash = filename.rfind('/');
+		names.push_back((slash == string::npos) ? filename : filename.substr(slash + 1));
+	}
+
+	while (true)
+	{
+		timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		const long timeout = (wake - now.tv_sec) * 1000 - now.tv_nsec / 1000000;
+		if (timeout <= 0) return;
+
+		// a queue and a watch per list, then the sockets of the servers
+		vector<pollfd> fds;
+		for (const auto& list : lists)
+		{
+			fds.push_back({ (int)list.mq, POLLIN, 0 });
+			fds.push_back({ list.watch_fd, POLLIN, 0 });
+		}
+		for (auto& list : lists)
+			if (list.daemon.server)
+			{
+				sv_swap(list.server);
+				sv_fds(fds);
+				sv_swap(list.server);
+			}
+
+		const int ready = poll(fds.data(), fds.size(), timeout);
+		if ((ready < 0) && (errno == EINTR)) continue;	// an action exited
+		if (ready <= 0) return;	// timeout
+
+		bool changed = false;
+		for (int i = 0; i < (int)fds.size(); i++)
+		{
+			if (fds.at(i).revents == 0) continue;
+			if ((i >= (int)lists.size() * 2) || (i % 2 == 0)) return;
+
+			const int& watch_fd = fds.at(i).fd;
+			const string& name = names.at(i / 2);
+
+			alignas(inotify_event) char buffer[4096];
+			ssize_t length;
+			while ((length = read(watch_fd, buffer, sizeof(buffer))) > 0)
+				for (char* ptr = buffer; ptr < buffer + length; )
 				{
-					if (e1.due <= ti_to_long("a0d"))
-					{
-						if (e1.due > da_cached_time)
-							cmd_exec(format_str(conf_get_cvar("on_task_failed_action"), e1));
-					} else if (e1.due <= ti_to_long("a1d"))
-					{
-						if (e1.due > ti_to_long(ti_to_tm(da_cached_time + ti_to_long("1d"))))
-							cmd_exec(format_str(conf_get_cvar("on_task_coming_action"), e1));
-					}
+					const inotify_event* event = (const inotify_event*)ptr;
+					if ((event->len > 0) && (strncmp(event->name, name.c_str(), name.length()) == 0)) changed = true;
+					ptr += sizeof(inotify_event) + event->len;
 				}
+		}
 
-				da_cache[cached_id] = e1;
-			}
+		if (changed) return;
+	}
+}
+#endif
+
+// put the list in place of the one in use, or back
+static void da_switch(da_list_s& list)
+{
+	li_swap(list.list);
+	da_swap(list.daemon);
+	sv_swap(list.server);
+}
+
+// lock the list and open its queue (and socket). False if the list can't be served
+static bool da_open(da_list_s& list, const string& filename)
+{
+	list.list.filename = filename;
+	list.list.autosave = false;
+	list.list.exec_workspace = false;
+	da_switch(list);
+
+	log("Serving " + li_filename + "...");
+
+	bool opened = false;
+	if (da_check_lockfile())
+		log("Lockfile " + da_name(DA_LOCK_FILE) + " exists. If daemon is not running, you can delete it or run noaftodo -l " + li_filename + " -k.");
+	else {
+		da_lock();
+
+		log("Opening a message queue...");
+		mq_attr attr;
+		attr.mq_maxmsg = 10;
+		attr.mq_msgsize = DA_MSGSIZE;
+		attr.mq_flags = 0;
+		list.mq = mq_open(da_name(DA_MQ_NAME).c_str(), O_CREAT | O_RDWR, S_IRUSR | S_IWUSR, &attr);
+
+		if (list.mq == (mqd_t)-1)
+		{
+			log("Failed!", LP_ERROR);
+			da_unlock();
+		} else opened = true;
+	}
+
+	if (opened)
+	{
+		log("OK");
+		li_load();
+
+		// resume: only the changes made while the daemon was down are reported
+		if (da_state_load())
+		{
+			list.first = false;
+			da_rediff = true;
 		}
 
-		// clear cache
-		for (int i = 0; i < da_cache.size(); i++)
+#ifdef __linux__
+		if (conf_get_cvar("server") == "true")
 		{
-			bool deleted = true;
-			for (int j = 0; j < t_list.size(); j++)
-				if (t_list.at(j).sim(da_cache.at(i))) deleted = false;
+			log("Opening " + da_name(SV_SOCKET_FILE) + "...");
+			da_server = sv_open();
 
-			if (deleted) 
+			if (da_server)
 			{
-				cmd_exec(format_str(conf_get_cvar("on_task_removed_action"), da_cache.at(i)));
-				da_cache.erase(da_cache.begin() + i);
-				i--;
-			}
+				// the daemon saves the list now
+				li_autosave = true;
+				log("OK");
+			} else log("Failed! The list file is only watched", LP_ERROR);
 		}
 
-		first = false;
-		da_cached_time = ti_to_long("a0d");
+		list.watch_fd = da_server ? -1 : da_watch();
+		if ((list.watch_fd == -1) && !da_server) log("Can't watch the list file. Checking it every " + to_string(da_interval) + " s", LP_ERROR);
+#else
+		if (conf_get_cvar("server") == "true") log("Server mode needs Linux. The list file is only watched", LP_ERROR);
+#endif
+	}
 
-		char msg[DA_MSGSIZE];
+	da_switch(list);
+	return opened;
+}
 
-		clock_gettime(CLOCK_REALTIME, &tout);
-		tout.tv_sec += da_interval;
+// the list is not served anymore. It's in use
+static void da_close(da_list_s& list)
+{
+	log("Stopping to serve " + li_filename + "...");
+
+	if (list.watch_fd != -1) close(list.watch_fd);
 
-		int status = mq_timedreceive(mq, msg, DA_MSGSIZE, NULL, &tout);
+	if (da_server)
+	{
+		log("Closing " + da_name(SV_SOCKET_FILE) + "...");
+		sv_close();
+
+		// the writer must not take its own files for someone else's
+		li_flush();
+		da_server = false;
+	}
+
+	da_batches_run(true);
+
+	if (da_state_fd != -1) close(da_state_fd);
+	da_state_fd = -1;
+
+	log("Closing message queue...");
+	mq_close(list.mq);
+	mq_unlink(da_name(DA_MQ_NAME).c_str());
+
+	da_unlock();
+}
+
+// look at what changed in the list in use and run the actions.
+// Returns the time the list has to be looked at again
+static time_t da_tick(da_list_s& list)
+{
+	// update cache. Only the lists that changed are read again.
+	// The server has the list already
+	auto start = chrono::steady_clock::now();
+	const bool changed = !da_server && li_load();
+	li_shard_need(-1);
 
+	if (changed)
+	{
+		st_count("list.reloads");
+		st_time("list.reload", start);
+
+		da_synced = true;
+		da_ahead.clear();
+		da_touched.clear();
+	}
+
+	// the time is taken once per tick
+	li_update_states(ti_snapshot());
+
+	start = chrono::steady_clock::now();
+	if (changed || list.first || da_rediff)
+	{
+		da_rediff = false;
+		da_touched.clear();
+		da_diff(list.first);
+
+		// every cached entry now points into the current list generation
+		da_cache_pool = li_pool;
+		st_time("daemon.diff", start);
+	} else {
+		da_diff_touched();
+		da_transitions();	// only the tasks that changed their state
+		st_time("daemon.diff_changes", start);
+	}
+
+	st_set("list.tasks[" + li_filename + "]", t_list.size());
+	st_set("daemon.next_deadline[" + li_filename + "]", da_deadlines.empty() ? 0 : da_deadlines.front().first);
+
+	da_batches_run(false);
+
+	list.first = false;
+	da_cached_time = li_time;
+	da_state_save();
+
+	// the next state change, or the time the list has to be looked at again
+	time_t wake = da_time() + ((list.watch_fd == -1) ? da_interval : DA_MAX_SLEEP);
+	if (!da_deadlines.empty()) wake = min(wake, da_deadlines.front().first);
+	for (const auto& batch : da_batches) wake = min(wake, batch.second.deadline);
+
+	return wake;
+}
+
+void da_run(const vector<string>& filenames)
+{
+	// checking the lists never waits for the actions
+	ex_async = true;
+
+	vector<da_list_s> lists;
+	for (const auto& filename : filenames)
+	{
+		lists.emplace_back();
+		if (!da_open(lists.back(), filename)) lists.pop_back();
+	}
+
+	if (lists.empty()) return;
+
+	cmd_exec(format_str(conf_get_cvar("on_daemon_launch_action"), noaftodo_entry {}));
+
+	// stats are written every "stats_interval" s, 0 - only when asked
+	time_t stats_due = da_time();
+
+	while (!lists.empty())
+	{
+		const time_t now = da_time();
+		const int stats_interval = conf_get_cvar_int("stats_interval");
+		const bool dump = (stats_interval > 0) && (now >= stats_due);
+		if (dump) stats_due = now + stats_interval;
+
+		time_t wake = now + DA_MAX_SLEEP;
+		if (stats_interval > 0) wake = min(wake, stats_due);
+
+		for (auto& list : lists)
+		{
+			da_switch(list);
+			wake = min(wake, da_tick(list));
+			da_switch(list);
+		}
+
+		// the stats are of the whole daemon: they go to the file of the first list
+		if (dump)
+		{
+			da_switch(lists.front());
+			da_stats_write();
+			da_switch(lists.front());
+		}
+
+		// sleep until the earliest of the lists has to be looked at
+		timespec tout;
+#ifdef __linux__
+		da_wait(lists, wake);
+#else
+		// only one queue can be waited for. The lists are
+		// looked at every da_interval s anyway
+		tout.tv_sec = wake;
+		tout.tv_nsec = 0;
+
+		da_message_s message;
+		if (mq_timedreceive(lists.front().mq, (char*)&message, DA_MSGSIZE, NULL, &tout) >= 0)
+			lists.front().received.push_back(message);
+#endif
+
+		// only the messages that are already there
 		clock_gettime(CLOCK_REALTIME, &tout);
-		while (status >= 0)
+
+		for (auto list = lists.begin(); list != lists.end(); )
 		{
-			log(msg);
+			da_switch(*list);
 
-			switch (msg[0])
-			{
-				case 'K':
-					running = false;
-					break;
-				case 'N':
-					for (int i = 0; i < t_list.size(); i++)
-					{
-						const noaftodo_entry e1 = t_list.at(i);
-						if (e1.completed)
-							cmd_exec(format_str(conf_get_cvar("on_task_completed_action"), e1, true));
-						else if (e1.due <= ti_to_long("a0d"))
-							cmd_exec(format_str(conf_get_cvar("on_task_failed_action"), e1, true));
-						else if (e1.due <= ti_to_long("a1d"))
-							cmd_exec(format_str(conf_get_cvar("on_task_coming_action"), e1, true));
-					}
-					break;
-			}
+			// changes are applied together, before the list files are looked at
+			da_message_s message;
+			while (mq_timedreceive(list->mq, (char*)&message, DA_MSGSIZE, NULL, &tout) >= 0)
+				list->received.push_back(message);
+			st_count("mq.received", list->received.size());
+
+			bool running = true;
+			da_messages(list->received, running);
+			list->received.clear();
+
+			if (da_server) sv_serve();
+
+			if (!running) da_close(*list);
+
+			da_switch(*list);
 
-			status = mq_timedreceive(mq, msg, DA_MSGSIZE, NULL, &tout);
+			if (running) list++;
+			else list = lists.erase(list);
 		}
 	}
 
-	log("Closing message queue...");
-	mq_close(mq);
-	mq_unlink(DA_MQ_NAME);
+	log("Waiting for the actions to finish...");
+	ex_flush();
+}
 
-	da_unlock();
+void da_swap(da_context_s& context)
+{
+	swap(da_ctx, context);
+}
+
+string da_name(const char base[])
+{
+	// the hash is taken again only when the list changes
+	static mutex lock;
+	static string filename;
+	static string hash;
+	lock_guard<mutex> guard(lock);
+
+	if (hash.empty() || (filename != li_filename))
+	{
+		filename = li_filename;
+
+		// FNV-1a
+		const string key = to_string(getuid()) + ':' + li_abs_filename(filename);
+		uint64_t h = 14695981039346656037ULL;
+		for (const char& c : key)
+		{
+			h ^= (uint8_t)c;
+			h *= 1099511628211ULL;
+		}
+
+		char hex[17];
+		snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+		hash = hex;
+	}
+
+	return string(base) + '.' + hash;
 }
 
 void da_kill()
@@ -177,7 +1076,7 @@ void da_kill()
 	log("Killing the daemon...");
 	da_send("K");
 	da_unlock();
-	mq_unlink(DA_MQ_NAME);
+	mq_unlink(da_name(DA_MQ_NAME).c_str());
 }
 
 void da_send(const char message[])
@@ -193,7 +1092,7 @@ void da_send(const char message[])
 	attr.mq_maxmsg = 10;
 	attr.mq_msgsize = DA_MSGSIZE;
 	attr.mq_flags = 0;
-	mqd_t mq = mq_open(DA_MQ_NAME, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR, &attr);
+	mqd_t mq = mq_open(da_name(DA_MQ_NAME).c_str(), O_CREAT | O_RDWR, S_IRUSR | S_IWUSR, &attr);
 
 	if (mq == -1)
 	{
@@ -202,7 +1101,9 @@ void da_send(const char message[])
 	}
 	log("OK");
 
-	int status = mq_send(mq, message, DA_MSGSIZE, 1);
+	da_message_s msg;
+	msg.op = message[0];
+	int status = mq_send(mq, (const char*)&msg, DA_MSGSIZE, 1);
 
 	if (status == -1)
 		log("Uh oh no success :(", LP_ERROR);
@@ -211,10 +1112,93 @@ void da_send(const char message[])
 	mq_close(mq);
 }
 
+bool da_stats(string& report)
+{
+	if (!da_check_lockfile())
+	{
+		log("Lock file not found. Is the daemon running?", LP_ERROR);
+		return false;
+	}
+
+	// the daemon writes a new one
+	const string filename = da_name(DA_STATS_FILE);
+	remove(filename.c_str());
+
+	da_send("T");
+
+	for (int waited = 0; waited < DA_STATS_WAIT; waited += 10)
+	{
+		ifstream ifile(filename);
+		if (ifile.good())
+		{
+			report.assign(istreambuf_iterator<char>(ifile), istreambuf_iterator<char>());
+			return true;
+		}
+
+		usleep(10000);
+	}
+
+	log("The daemon did not write its stats", LP_ERROR);
+	return false;
+}
+
+void da_send(const da_message_s& message)
+{
+	// the server's own changes. The files it writes are its own too
+	if (da_server)
+	{
+		if (message.op != DA_OP_SAVED) da_changed(message);
+		return;
+	}
+
+	// the queue is kept open: changes are sent one by one
+	static mutex lock;
+	static mqd_t mq = (mqd_t)-1;
+	static string name;
+	static pair<ino_t, int64_t> daemon = { 0, 0 };	// lock file of the daemon the queue is of
+	lock_guard<mutex> guard(lock);
+
+	// the queue of another list
+	const string current = da_name(DA_MQ_NAME);
+	if (current != name)
+	{
+		if (mq != (mqd_t)-1) mq_close(mq);
+		mq = (mqd_t)-1;
+		name = current;
+	}
+
+	// a daemon started since has a queue of its own. The old one
+	// takes messages until it's full, and no one reads them
+	struct stat st;
+	const bool locked = (stat(da_name(DA_LOCK_FILE).c_str(), &st) == 0);
+	const pair<ino_t, int64_t> lock_file = { locked ? st.st_ino : 0, locked ? (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec : 0 };
+	if (locked && (mq != (mqd_t)-1) && (lock_file != daemon))
+	{
+		mq_close(mq);
+		mq = (mqd_t)-1;
+	}
+
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		if (mq == (mqd_t)-1)
+		{
+			mq = mq_open(name.c_str(), O_WRONLY | O_NONBLOCK);
+			daemon = lock_file;
+		}
+		if (mq == (mqd_t)-1) return;	// no daemon
+
+		if (mq_send(mq, (const char*)&message, DA_MSGSIZE, 1) == 0) return;
+
+		// full, or left by a daemon that's gone. Another one might have opened a new queue
+		mq_close(mq);
+		mq = (mqd_t)-1;
+	}
+}
+
 void da_lock()
 {
 	log("Creating lock file...");
-	ofstream l_file(DA_LOCK_FILE);
+	ofstream l_file(da_name(DA_LOCK_FILE));
 
 	l_file << getpid() << endl;
 
@@ -226,11 +1210,11 @@ void da_lock()
 void da_unlock()
 {
 	log("Removing lock file...");
-	remove(DA_LOCK_FILE);
+	remove(da_name(DA_LOCK_FILE).c_str());
 }
 
 bool da_check_lockfile()
 {
-	ifstream l_file(DA_LOCK_FILE);
+	ifstream l_file(da_name(DA_LOCK_FILE));
 	return l_file.good();
 }
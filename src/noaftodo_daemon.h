@@ -1,6 +1,12 @@
 #ifndef NOAFTODO_DAEMON_H
 #define NOAFTODO_DAEMON_H
 
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "noaftodo_list.h"
@@ -13,28 +19,160 @@ constexpr char DA_M_TUNCOMPLETE[] = "Task is marked \"Not completed\" again!";
 constexpr char DA_M_TNEW[] = "You have a new task!";
 constexpr char DA_M_TREM[] = "Task removed!";
 
-// message queue name
+// message queue name. Every list has its own, see da_name()
 constexpr char DA_MQ_NAME[] = "/noaftodo-msg-queue";
 
-// lock file name
+// lock file name. Every list has its own, see da_name()
 constexpr char DA_LOCK_FILE[] = "/tmp/.noaftodo-dlock";
 
+// the daemon writes its stats there when asked, see noaftodo_stats.h.
+// Every list has its own, see da_name()
+constexpr char DA_STATS_FILE[] = "/tmp/.noaftodo-stats";
+
+// how long da_stats() waits for the daemon to write them, ms
+constexpr int DA_STATS_WAIT = 2000;
+
+// the daemon keeps its cache in "<list dir>/.<list name>.daemon-state", so that
+// a restarted daemon runs the actions only for what changed while it was down.
+// The file is a magic and records, appended as the cache changes:
+// DA_STATE_TIME - da_cached_time, DA_STATE_SET - a cached entry with its fingerprint,
+// state and deadline, DA_STATE_ERASE - an entry gone
+constexpr char DA_STATE_SUFFIX[] = ".daemon-state";
+constexpr char DA_STATE_MAGIC[8] = { 'N', 'O', 'A', 'F', 'D', 'S', 'T', '2' };
+constexpr char DA_STATE_TIME = 't';
+constexpr char DA_STATE_SET = 's';
+constexpr char DA_STATE_ERASE = 'e';
+
+// the state file is written anew once the records appended to it
+// take more than that many times its size (and at least DA_STATE_MIN bytes)
+constexpr int DA_STATE_SLACK = 2;
+constexpr size_t DA_STATE_MIN = 64 * 1024;
+
 // message size
 constexpr int DA_MSGSIZE = 256;
 
+// message ops. Changes to the list are sent with the journal record
+// types (LI_J_ADD, LI_J_COMP, ...), so that the daemon applies them
+// instead of reading the list file again
+constexpr char DA_OP_KILL = 'K';
+constexpr char DA_OP_RENOTIFY = 'N';
+constexpr char DA_OP_RELOAD = 'L';	// the list changed in a way a message can't tell
+constexpr char DA_OP_SAVED = 'S';	// a list file was written
+constexpr char DA_OP_STATS = 'T';	// write the stats to the stats file
+
+// messages older than that are a single letter
+constexpr uint8_t DA_M_VERSION = 1;
+
+struct da_message_s
+{
+	char op = 0;
+	uint8_t version = DA_M_VERSION;
+	uint8_t completed = 0;
+	uint8_t truncated = 0;	// the strings did not fit
+	uint8_t format = 0;	// DA_OP_SAVED: li_format and li_sharded of the file
+	uint8_t sharded = 0;
+	uint16_t lengths[2] = { 0, 0 };	// of the strings: title and description, or the file name
+
+	int32_t tag = 0;
+	uint32_t changes = 0;	// change number N on top of "generation".
+				// DA_OP_SAVED: changes on top of "base" the file has
+	int64_t generation = 0;	// of the list file the change was made to. DA_OP_SAVED: of the file
+	int64_t base = 0;	// DA_OP_SAVED: generation the file was made from
+
+	uint64_t id = 0;
+	int64_t due = 0;
+	li_file_id_s file;	// DA_OP_SAVED: the file written
+
+	char strings[DA_MSGSIZE - 80];
+};
+
+static_assert(sizeof(da_message_s) == DA_MSGSIZE, "da_message_s has to fill a message");
+
+// the longest the daemon sleeps, in seconds. The wait does not count the
+// time the system is suspended, so it should not sleep through a deadline
+constexpr int DA_MAX_SLEEP = 60;
+
+// a task as the daemon last saw it
+struct da_cached_s
+{
+	noaftodo_entry entry;
+	uint64_t fingerprint = 0;	// of its due, title and description, 0 - none yet
+	uint8_t state = 0;		// the state the deadline is for
+	time_t deadline = 0;		// its next state change, 0 - none. Others in da_deadlines are stale
+	uint32_t pass = 0;		// the last full diff that saw it
+};
+
 // cache
-extern std::vector<noaftodo_entry> da_cache;
-extern long da_cached_time;
+extern std::unordered_map<uint64_t, da_cached_s>& da_cache;	// entry ID -> the task as it was last seen
+extern std::shared_ptr<li_pool_s>& da_cache_pool;	// keeps strings of cached entries alive
+extern ti_snapshot_s& da_cached_time;	// the time the cache was last looked at
+
+// min-heap of (time a task changes its state, its ID)
+extern std::vector<std::pair<time_t, uint64_t>>& da_deadlines;
+
+// tasks that changed the same way within "batch_window" seconds
+struct da_batch_s
+{
+	std::vector<noaftodo_entry> entries;	// strings are in "strings"
+	std::deque<std::string> strings;
+	time_t deadline;			// the action is run then
+};
+
+// (kind, renotify) -> tasks waiting to be reported
+extern std::map<std::pair<std::string, bool>, da_batch_s>& da_batches;
+
+// everything da_ keeps about a list. The globals are the fields of the
+// one in use. A daemon serves a list at a time, see da_swap()
+struct da_context_s
+{
+	std::unordered_map<uint64_t, da_cached_s> cache;
+	std::shared_ptr<li_pool_s> cache_pool;
+	ti_snapshot_s cached_time;
+	std::vector<std::pair<time_t, uint64_t>> deadlines;
+	std::map<std::pair<std::string, bool>, da_batch_s> batches;
+
+	bool synced = true;
+	std::vector<da_message_s> ahead;
+	std::unordered_set<uint64_t> touched;
+	bool server = false;
+	bool rediff = false;
+
+	// the state file, see DA_STATE_SUFFIX
+	int state_fd = -1;
+	size_t state_size = 0;		// as written anew
+	size_t state_appended = 0;	// appended since
+	std::unordered_set<uint64_t> state_dirty;	// cached entries that changed since the last write
+	bool state_changed = false;	// actions were run: da_cached_time has to be written
+};
 
 // check interval
 extern int da_interval;
 
-void da_run();
+// serve the lists. The daemon exits once all of them are stopped
+void da_run(const std::vector<std::string>& filenames);
+
+// put another list's daemon state in place of the one in use, see li_swap().
+// The list writer is not running: li_swap() stops it
+void da_swap(da_context_s& context);
+
+// name of a file or queue of the daemon of li_filename: the base,
+// followed by a hash of the user and the list path
+std::string da_name(const char base[]);
 
 void da_kill();
 
 void da_send(const char message[]);
 
+// ask the daemon for its stats. False if it did not write them in time
+bool da_stats(std::string& report);
+
+// the change a message tells about. Strings point into the message
+noaftodo_entry da_entry(const da_message_s& message);
+
+// send a message to the daemon, if it runs. Never waits: if the queue is
+// full, the message is dropped and the daemon reads the list file instead
+void da_send(const da_message_s& message);
+
 void da_lock();
 void da_unlock();
 bool da_check_lockfile();
@@ -0,0 +1,298 @@
+#include "noaftodo_exec.h"
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdlib>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <poll.h>
+#include <spawn.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <sys/wait.h>
+
+#include "noaftodo_config.h"
+#include "noaftodo_output.h"
+#include "noaftodo_stats.h"
+
+using namespace std;
+using namespace chrono;
+
+extern char** environ;
+
+struct ex_job_s
+{
+	string command;
+	int timeout;	// s, 0 - none
+	steady_clock::time_point queued;
+};
+
+struct ex_child_s
+{
+	pid_t pid;
+	steady_clock::time_point deadline;	// SIGTERM then
+	bool terminated;			// SIGKILL EX_KILL_GRACE ms later
+};
+
+bool ex_async = false;
+
+static struct
+{
+	mutex lock;			// guards everything below
+	thread worker;
+	bool stop = false;		// run what's queued and exit
+	steady_clock::time_point stop_by;	// then leave the rest running
+
+	deque<ex_job_s> queue;
+	int jobs = 1;			// cvars, as of the last ex_run()
+	bool overflow = false;		// commands were dropped since the queue was last empty
+} ex_pool;
+
+// the worker sleeps on this pipe. A byte is written to it when a command
+// is queued, when the pool is told to stop and when a child exits
+static int ex_wake_fds[2] = { -1, -1 };
+
+static void ex_pool_run();
+
+static void ex_wake()
+{
+	const int saved_errno = errno;	// it's called from the signal handler too
+
+	const char c = 0;
+	while ((write(ex_wake_fds[1], &c, 1) < 0) && (errno == EINTR));
+
+	errno = saved_errno;
+}
+
+static void ex_sigchld(int)
+{
+	ex_wake();
+}
+
+// the pipe and the SIGCHLD handler. Only the daemon runs commands in the background
+static bool ex_wake_init()
+{
+	if (ex_wake_fds[0] != -1) return true;
+
+	if (pipe2(ex_wake_fds, O_CLOEXEC | O_NONBLOCK) != 0)
+	{
+		log("Can't make a pipe for the actions", LP_ERROR);
+		return false;
+	}
+
+	struct sigaction action = {};
+	action.sa_handler = ex_sigchld;
+	action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGCHLD, &action, nullptr);
+
+	return true;
+}
+
+// sleep until "wake" or ex_wake()
+static void ex_sleep(const steady_clock::time_point& wake)
+{
+	int timeout = -1;
+	if (wake != steady_clock::time_point::max())
+	{
+		const auto left = duration_cast<milliseconds>(wake - steady_clock::now()) + milliseconds(1);
+		timeout = (int)max<int64_t>(0, min<int64_t>(left.count(), INT_MAX));
+	}
+
+	pollfd fd = { ex_wake_fds[0], POLLIN, 0 };
+	poll(&fd, 1, timeout);
+	st_count("exec.wakeups");
+
+	char buffer[64];
+	while (read(ex_wake_fds[0], buffer, sizeof(buffer)) > 0);
+}
+
+// split a command into arguments if it's simple enough to be run without a shell
+static vector<string> ex_argv(const string& command)
+{
+	if (command.find_first_of(EX_SHELL_CHARS) != string::npos) return { "/bin/sh", "-c", command };
+
+	vector<string> args;
+	string arg = "";
+	for (const char c : command)
+	{
+		if ((c == ' ') || (c == '\t'))
+		{
+			if (arg != "") args.push_back(arg);
+			arg = "";
+		} else arg += c;
+	}
+	if (arg != "") args.push_back(arg);
+
+	return args;
+}
+
+// -1 if it could not be started
+static pid_t ex_spawn(const string& command)
+{
+	const vector<string> args = ex_argv(command);
+	if (args.empty()) return -1;
+
+	vector<char*> argv;
+	for (const auto& arg : args) argv.push_back((char*)arg.c_str());
+	argv.push_back(nullptr);
+
+	// in its own process group, so that a timeout stops everything the shell started
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+	posix_spawnattr_setpgroup(&attr, 0);
+
+	pid_t pid;
+	const int status = posix_spawnp(&pid, argv.at(0), nullptr, &attr, argv.data(), environ);
+	posix_spawnattr_destroy(&attr);
+
+	if (status != 0)
+	{
+		log("Can't run " + command, LP_ERROR);
+		return -1;
+	}
+
+	return pid;
+}
+
+void ex_run(const string& command)
+{
+	if (!ex_async)
+	{
+		system(command.c_str());
+		return;
+	}
+
+	const int queue_size = conf_get_cvar_int("exec_queue");
+	const bool drop_old = (conf_get_cvar("exec_overflow") == "drop_old");
+
+	lock_guard<mutex> lock(ex_pool.lock);
+
+	// cvars are not touched from the worker thread
+	ex_pool.jobs = max(conf_get_cvar_int("exec_jobs"), 1);
+
+	if ((int)ex_pool.queue.size() >= max(queue_size, 1))
+	{
+		if (!ex_pool.overflow) log("Too many actions queued. Dropping " + string(drop_old ? "the oldest ones" : "new ones"), LP_ERROR);
+		ex_pool.overflow = true;
+		st_count("exec.dropped");
+
+		if (!drop_old) return;
+		ex_pool.queue.pop_front();
+	}
+
+	if (!ex_wake_init())
+	{
+		system(command.c_str());
+		return;
+	}
+
+	ex_pool.queue.push_back({ command, conf_get_cvar_int("exec_timeout"), steady_clock::now() });
+
+	if (!ex_pool.worker.joinable()) ex_pool.worker = thread(ex_pool_run);
+
+	ex_wake();
+}
+
+void ex_flush()
+{
+	const int timeout = max(conf_get_cvar_int("exec_flush_timeout"), 0);
+
+	unique_lock<mutex> lock(ex_pool.lock);
+	if (!ex_pool.worker.joinable()) return;
+
+	ex_pool.stop = true;
+	ex_pool.stop_by = steady_clock::now() + seconds(timeout);
+	ex_wake();
+	lock.unlock();
+
+	ex_pool.worker.join();
+
+	lock.lock();
+	ex_pool.stop = false;
+}
+
+static void ex_pool_run()
+{
+	vector<ex_child_s> children;	// only this thread touches them
+
+	unique_lock<mutex> lock(ex_pool.lock);
+
+	while (true)
+	{
+		// start what fits
+		while (!ex_pool.queue.empty() && ((int)children.size() < ex_pool.jobs))
+		{
+			const ex_job_s job = ex_pool.queue.front();
+			ex_pool.queue.pop_front();
+			if (ex_pool.queue.empty()) ex_pool.overflow = false;
+
+			lock.unlock();
+			const pid_t pid = ex_spawn(job.command);
+			st_time("exec.spawn_latency", job.queued);
+			lock.lock();
+
+			if (pid != -1) children.push_back({ pid,
+					(job.timeout > 0) ? (steady_clock::now() + seconds(job.timeout)) : steady_clock::time_point::max(),
+					false });
+		}
+
+		if (ex_pool.stop)
+		{
+			if (children.empty() && ex_pool.queue.empty()) break;
+
+			if (steady_clock::now() >= ex_pool.stop_by)
+			{
+				log("Stopped waiting for the actions. " + to_string(children.size()) + " are left running, " +
+						to_string(ex_pool.queue.size()) + " queued ones are dropped", LP_ERROR);
+				ex_pool.queue.clear();
+				ex_pool.overflow = false;
+				break;
+			}
+		}
+
+		// sleep until a child exits or has to be stopped, or there's more to run
+		steady_clock::time_point wake = ex_pool.stop ? ex_pool.stop_by : steady_clock::time_point::max();
+		for (const auto& child : children) wake = min(wake, child.deadline);
+
+		lock.unlock();
+
+		ex_sleep(wake);
+
+		// reap the finished ones, stop the ones that take too long
+		const auto now = steady_clock::now();
+		for (auto child = children.begin(); child != children.end(); )
+		{
+			if (waitpid(child->pid, nullptr, WNOHANG) != 0)
+			{
+				child = children.erase(child);
+				continue;
+			}
+
+			if (now >= child->deadline)
+			{
+				if (child->terminated)
+				{
+					kill(-child->pid, SIGKILL);
+					child->deadline = steady_clock::time_point::max();	// it can't outlive that
+				}
+				else
+				{
+					log("Action " + to_string(child->pid) + " timed out", LP_ERROR);
+					kill(-child->pid, SIGTERM);
+					child->terminated = true;
+					child->deadline = now + milliseconds(EX_KILL_GRACE);
+				}
+			}
+
+			child++;
+		}
+
+		lock.lock();
+	}
+}
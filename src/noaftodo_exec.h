@@ -0,0 +1,24 @@
+#ifndef NOAFTODO_EXEC_H
+#define NOAFTODO_EXEC_H
+
+#include <string>
+
+// commands without these characters are run without a shell
+constexpr char EX_SHELL_CHARS[] = "|&;<>()$`\\\"'*?[]#~=%{}!\n";
+
+// how long a timed out command gets to exit before it's killed, ms
+constexpr int EX_KILL_GRACE = 1000;
+
+extern bool ex_async;	// run shell commands in the background. Set by the daemon
+
+// run a shell command. In the background, up to "exec_jobs" at a time,
+// if ex_async is set: commands wait in a queue of at most "exec_queue"
+// and are stopped after "exec_timeout" seconds. The pool sleeps until a
+// command exits or times out: SIGCHLD is caught for that
+void ex_run(const std::string& command);
+
+// wait for the background commands to finish, at most "exec_flush_timeout"
+// seconds. The ones still running then are left running
+void ex_flush();
+
+#endif
@@ -0,0 +1,440 @@
+#include "noaftodo_import.h"
+
+#include <cctype>
+#include <charconv>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "noaftodo_list.h"
+#include "noaftodo_output.h"
+#include "noaftodo_time.h"
+
+using namespace std;
+
+// split a CSV record. False if a quoted field goes on in the next line
+static bool im_split_csv(const string& line, vector<string>& fields)
+{
+	fields.assign(1, "");
+	bool quoted = false;
+
+	for (size_t i = 0; i < line.length(); i++)
+	{
+		const char c = line.at(i);
+
+		if (quoted)
+		{
+			if (c != '"') fields.back() += c;
+			else if ((i + 1 < line.length()) && (line.at(i + 1) == '"'))
+			{
+				fields.back() += '"';
+				i++;
+			} else quoted = false;
+		}
+		else if (c == '"') quoted = true;
+		else if (c == ',') fields.emplace_back();
+		else if (c != '\r') fields.back() += c;
+	}
+
+	return !quoted;
+}
+
+static void im_split_tsv(const string& line, vector<string>& fields)
+{
+	fields.assign(1, "");
+
+	for (const char c : line)
+	{
+		if (c == '\t') fields.emplace_back();
+		else if (c != '\r') fields.back() += c;
+	}
+}
+
+// append a code point as UTF-8
+static void im_utf8(string& str, const unsigned long& cp)
+{
+	if (cp < 0x80) str += (char)cp;
+	else if (cp < 0x800)
+	{
+		str += (char)(0xc0 | (cp >> 6));
+		str += (char)(0x80 | (cp & 0x3f));
+	} else if (cp < 0x10000)
+	{
+		str += (char)(0xe0 | (cp >> 12));
+		str += (char)(0x80 | ((cp >> 6) & 0x3f));
+		str += (char)(0x80 | (cp & 0x3f));
+	} else {
+		str += (char)(0xf0 | (cp >> 18));
+		str += (char)(0x80 | ((cp >> 12) & 0x3f));
+		str += (char)(0x80 | ((cp >> 6) & 0x3f));
+		str += (char)(0x80 | (cp & 0x3f));
+	}
+}
+
+// parse a flat JSON object. Strings are unescaped, other values
+// (numbers, true, false, null) are kept as they are written
+static bool im_parse_json(const string& line, map<string, string>& fields)
+{
+	fields.clear();
+	size_t i = 0;
+
+	const auto skip_ws = [&]() { while ((i < line.length()) && isspace((unsigned char)line.at(i))) i++; };
+	const auto hex4 = [&](unsigned long& cp)
+	{
+		if (i + 4 > line.length()) return false;
+
+		cp = 0;
+		const auto res = from_chars(line.data() + i, line.data() + i + 4, cp, 16);
+		if (res.ptr != line.data() + i + 4) return false;
+
+		i += 4;
+		return true;
+	};
+	const auto parse_str = [&](string& str)
+	{
+		str.clear();
+		if ((i >= line.length()) || (line.at(i) != '"')) return false;
+
+		for (i++; i < line.length(); i++)
+		{
+			const char c = line.at(i);
+			if (c == '"')
+			{
+				i++;
+				return true;
+			}
+
+			if (c != '\\')
+			{
+				str += c;
+				continue;
+			}
+
+			if (++i >= line.length()) return false;
+
+			switch (line.at(i))
+			{
+				case 'b': str += '\b'; break;
+				case 'f': str += '\f'; break;
+				case 'n': str += '\n'; break;
+				case 'r': str += '\r'; break;
+				case 't': str += '\t'; break;
+				case 'u':
+				{
+					unsigned long cp;
+					i++;
+					if (!hex4(cp)) return false;
+
+					// surrogate pair
+					if ((cp >= 0xd800) && (cp < 0xdc00) && (i + 1 < line.length()) && (line.at(i) == '\\') && (line.at(i + 1) == 'u'))
+					{
+						unsigned long low;
+						i += 2;
+						if (!hex4(low)) return false;
+						cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+					}
+
+					im_utf8(str, cp);
+					i--;
+					break;
+				}
+				default: str += line.at(i);
+			}
+		}
+
+		return false;
+	};
+
+	skip_ws();
+	if ((i >= line.length()) || (line.at(i) != '{')) return false;
+	i++;
+
+	skip_ws();
+	if ((i < line.length()) && (line.at(i) == '}')) return true;
+
+	while (i < line.length())
+	{
+		string key, value;
+
+		skip_ws();
+		if (!parse_str(key)) return false;
+
+		skip_ws();
+		if ((i >= line.length()) || (line.at(i) != ':')) return false;
+		i++;
+
+		skip_ws();
+		if (i >= line.length()) return false;
+
+		if (line.at(i) == '"')
+		{
+			if (!parse_str(value)) return false;
+		} else {
+			// nested objects and arrays are not supported
+			if ((line.at(i) == '{') || (line.at(i) == '[')) return false;
+
+			const size_t end = line.find_first_of(",} \t\r", i);
+			if (end == string::npos) return false;
+
+			value = line.substr(i, end - i);
+			i = end;
+		}
+
+		fields[key] = value;
+
+		skip_ws();
+		if (i >= line.length()) return false;
+		if (line.at(i) == '}') return true;
+		if (line.at(i) != ',') return false;
+		i++;
+	}
+
+	return false;
+}
+
+// a time that is on the calendar
+static bool im_valid(const long& due)
+{
+	return (due > 0) && (ti_from_minutes(ti_to_minutes(due)) == due);
+}
+
+// a time expression the "a" command takes: [a](<number><y|m|d|h>)*[<number>]
+static bool im_expr(const string& str)
+{
+	bool digits = false;
+
+	for (size_t i = (str.at(0) == 'a') ? 1 : 0; i < str.length(); i++)
+	{
+		const char c = str.at(i);
+		if (isdigit((unsigned char)c)) digits = true;
+		else if (digits && ((c == 'y') || (c == 'm') || (c == 'd') || (c == 'h'))) digits = false;
+		else return false;
+	}
+
+	return true;
+}
+
+// due as YYYYMMDDhhmm, "YYYY-MM-DD[ hh:mm]" or a time the "a" command takes, at "now".
+// False if it's none of these, or not a real date
+static bool im_due(const string& str, const long& now, long& due)
+{
+	if (str.empty()) return false;
+
+	if ((str.length() == 12) && (str.find_first_not_of("0123456789") == string::npos))
+	{
+		from_chars(str.data(), str.data() + str.length(), due);
+		return im_valid(due);
+	}
+
+	// all of the string: "2024-01-01 lunch" is not a date
+	int year, month, day, hour = 0, minute = 0;
+	int length = 0;
+	if ((sscanf(str.c_str(), "%4d-%2d-%2d%n", &year, &month, &day, &length) == 3) && (length == 10))
+	{
+		if (length < (int)str.length())
+		{
+			int time_length = 0;
+			if ((str.length() != 16) || ((str.at(10) != ' ') && (str.at(10) != 'T')) ||
+					(sscanf(str.c_str() + 11, "%2d:%2d%n", &hour, &minute, &time_length) != 2) || (time_length != 5))
+				return false;
+		}
+
+		if ((hour > 23) || (minute > 59)) return false;
+
+		due = ti_pack(year, month, day, hour, minute);
+		return im_valid(due);
+	}
+
+	if (!im_expr(str)) return false;
+
+	due = ti_to_long(str, now);
+	return im_valid(due);
+}
+
+// the list file has no escaping: backslashes and line breaks can't be stored
+static string im_clean(string str)
+{
+	for (char& c : str)
+	{
+		if (c == '\\') c = '/';
+		else if ((c == '\n') || (c == '\r')) c = ' ';
+	}
+
+	return str;
+}
+
+// make an entry out of the record fields. Its strings are kept in "strings".
+// Error - what's wrong with the record, if it's false
+static bool im_entry(const string& due, const string& title, const string& description, const string& tag, const string& completed,
+		const long& now, deque<string>& strings, noaftodo_entry& li_entry, string& error)
+{
+	li_entry = { false, 0, "", "", 0, 0 };
+
+	if (title.empty())
+	{
+		error = "no title";
+		return false;
+	}
+
+	if (!im_due(due, now, li_entry.due))
+	{
+		error = "bad due \"" + due + "\"";
+		return false;
+	}
+
+	if (!tag.empty())
+	{
+		const auto res = from_chars(tag.data(), tag.data() + tag.length(), li_entry.tag);
+		if ((res.ec != errc()) || (res.ptr != tag.data() + tag.length()) || (li_entry.tag < 0))
+		{
+			error = "bad tag \"" + tag + "\"";
+			return false;
+		}
+	}
+
+	li_entry.completed = (completed == "true") || (completed == "1") || (completed == "v") || (completed == "yes");
+
+	strings.push_back(im_clean(title));
+	li_entry.title = strings.back();
+	strings.push_back(im_clean(description));
+	li_entry.description = strings.back();
+
+	return true;
+}
+
+int im_import(const string& filename)
+{
+	ifstream file;
+	if (filename != "-")
+	{
+		file.open(filename);
+		if (!file.good())
+		{
+			log("Can't open " + filename, LP_ERROR);
+			return 0;
+		}
+	}
+
+	istream& in = (filename == "-") ? cin : file;
+
+	log("Importing tasks from " + filename + "...");
+
+	int format = -1;
+	int count = 0;
+	int line_no = 0;
+	int skipped = 0;
+
+	vector<noaftodo_entry> batch;
+	deque<string> strings;
+	vector<string> fields;
+	map<string, string> object;
+
+	// only one batch is in memory at a time
+	const auto add_batch = [&]()
+	{
+		li_add(batch);
+		count += batch.size();
+		batch.clear();
+		strings.clear();
+	};
+
+	// relative dues are taken at the time the import started
+	const long now = ti_snapshot().now;
+
+	// the list is sorted, saved and the daemon is notified once, in the end
+	li_bulk_begin();
+
+	// lines a record with a quote that's not closed has taken, to be read again
+	deque<string> unread;
+	const auto next_line = [&](string& line)
+	{
+		if (unread.empty()) return (bool)getline(in, line);
+
+		line = unread.front();
+		unread.pop_front();
+		return true;
+	};
+
+	string line;
+	while (next_line(line))
+	{
+		line_no++;
+		const int record_line = line_no;
+
+		if (line.find_first_not_of(" \t\r") == string::npos) continue;
+
+		bool first = false;
+		if (format == -1)
+		{
+			first = true;
+			if (line.at(line.find_first_not_of(" \t")) == '{') format = IM_NDJSON;
+			else if (line.find('\t') != string::npos) format = IM_TSV;
+			else format = IM_CSV;
+		}
+
+		noaftodo_entry li_entry;
+		bool ok = false;
+		string error = "not a record";
+
+		if (format == IM_NDJSON)
+		{
+			if (im_parse_json(line, object))
+			{
+				const auto field = [&object](const string& key) { const auto it = object.find(key); return (it == object.end()) ? string() : it->second; };
+				ok = im_entry(field("due"), field("title"), field("description"), field("tag"), field("completed"), now, strings, li_entry, error);
+			}
+		} else {
+			if (format == IM_CSV)
+			{
+				// quoted fields can have line breaks in them, up to IM_RECORD_MAX of them
+				vector<string> more;
+				string next;
+				bool closed;
+				while (!(closed = im_split_csv(line, fields)) && (line.length() <= IM_RECORD_MAX) && next_line(next))
+				{
+					line_no++;
+					(line += '\n') += next;
+					more.push_back(next);
+				}
+
+				if (!closed)
+				{
+					// the lines after it are records of their own
+					unread.insert(unread.begin(), more.begin(), more.end());
+					line_no -= more.size();
+
+					log(filename + ":" + to_string(record_line) + ": the quote is not closed. Skipped", LP_ERROR);
+					skipped++;
+					continue;
+				}
+			} else im_split_tsv(line, fields);
+
+			// header
+			if (first && (fields.at(0) == "due")) continue;
+
+			fields.resize(max<size_t>(fields.size(), 5));
+			ok = im_entry(fields.at(0), fields.at(1), fields.at(2), fields.at(3), fields.at(4), now, strings, li_entry, error);
+		}
+
+		if (!ok)
+		{
+			log(filename + ":" + to_string(record_line) + ": " + error + ". Skipped", LP_ERROR);
+			skipped++;
+			continue;
+		}
+
+		batch.push_back(li_entry);
+		if (batch.size() >= IM_BATCH) add_batch();
+	}
+
+	add_batch();
+
+	li_bulk_end();
+
+	log("Imported " + to_string(count) + " tasks, skipped " + to_string(skipped));
+
+	return count;
+}
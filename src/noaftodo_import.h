@@ -0,0 +1,27 @@
+#ifndef NOAFTODO_IMPORT_H
+#define NOAFTODO_IMPORT_H
+
+#include <cstddef>
+#include <string>
+
+// import formats
+constexpr int IM_CSV = 0;
+constexpr int IM_TSV = 1;
+constexpr int IM_NDJSON = 2;
+
+// tasks are handed to li_add() in batches of that many
+constexpr int IM_BATCH = 4096;
+
+// a CSV record with line breaks in quotes can be that long, bytes.
+// A quote that's not closed by then or by the end of the file is a bad record
+constexpr size_t IM_RECORD_MAX = 64 * 1024;
+
+// import tasks from a file, "-" - from standard input. The format is
+// guessed from the first line: '{' - NDJSON, a tab - TSV, else CSV.
+// CSV and TSV columns: due, title, description[, tag[, completed]],
+// a first line starting with "due" is a header.
+// NDJSON keys: "due", "title", "description", "tag", "completed".
+// Returns the number of tasks imported
+int im_import(const std::string& filename);
+
+#endif
@@ -1,218 +1,2077 @@
 #include "noaftodo_list.h"
 
 #include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
 #include <fstream>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "noaftodo_cmd.h"
 #include "noaftodo_config.h"
 #include "noaftodo_daemon.h"
 #include "noaftodo_output.h"
+#include "noaftodo_server.h"
+#include "noaftodo_stats.h"
 
 using namespace std;
 
-vector<noaftodo_entry> t_list;
-vector<string> t_tags;
-string li_filename = ".noaftodo-list";
-bool li_autosave = true;
+// the list in use. li_swap() puts another one in its place
+static li_context_s li_ctx;
 
-bool noaftodo_entry::sim(const noaftodo_entry& e2)
+vector<noaftodo_entry>& t_list = li_ctx.list;
+vector<string>& t_tags = li_ctx.tags;
+string& li_filename = li_ctx.filename;
+bool& li_autosave = li_ctx.autosave;
+long& li_generation = li_ctx.generation;
+uint32_t& li_changes = li_ctx.changes;
+int& li_format = li_ctx.format;
+int& li_bulk = li_ctx.bulk;
+bool& li_sorted = li_ctx.sorted;
+bool& li_exec_workspace = li_ctx.exec_workspace;
+bool& li_sharded = li_ctx.sharded;
+vector<li_shard_s>& li_shards = li_ctx.shards;
+
+static bool& li_unsaved = li_ctx.unsaved;		// a bulk edit has changes to save
+static bool& li_modified = li_ctx.modified;		// t_list differs from what was loaded
+
+// what li_load() has loaded last
+static string& li_loaded_of = li_ctx.loaded_of;
+static li_file_id_s& li_loaded_file = li_ctx.loaded_file;
+static li_file_id_s& li_loaded_journal = li_ctx.loaded_journal;
+static unordered_map<string, li_file_id_s>& li_replaced = li_ctx.replaced;	// path -> the file li_saved() said is being replaced
+
+// what li_serialize_X() writes besides a shard
+constexpr int LI_SHARD_ALL = -1;		// the whole list
+constexpr int LI_SHARD_MANIFEST = -2;		// tags, shards and workspace of the sharded layout
+static bool& li_pending_reload = li_ctx.pending_reload;	// a bulk edit has to tell the daemon to read the list
+
+unordered_map<uint64_t, int>& li_index = li_ctx.index;
+li_columns_s& li_cols = li_ctx.cols;
+ti_snapshot_s& li_time = li_ctx.time;
+shared_ptr<li_pool_s>& li_pool = li_ctx.pool;
+
+// lock order: li_disk_mutex, li_mutex, li_writer.lock
+static recursive_mutex li_mutex;	// held while the list changes or is serialized
+static mutex li_disk_mutex;		// one writer of the list and journal files at a time
+
+// background writer. Changes are handed to it and written to disk
+// together after autosave_delay ms
+static struct
+{
+	mutex lock;			// guards everything below
+	condition_variable cv;
+	thread worker;
+	bool stop = false;		// write what's left and exit
+
+	bool snapshot = false;		// the whole list has to be written
+	vector<string> records;		// journal records to append
+	vector<string> workspace;	// as of the last change
+	int delay = 0;
+	int journal_limit = 0;
+} li_writer;
+
+// a generation of the list files, ready to be written
+struct li_snapshot_s
+{
+	vector<pair<string, string>> files;	// filename, contents
+	long generation = 0;
+	long base = 0;			// generation it was made from
+	uint32_t changes = 0;		// changes on top of base it has
+	int format = LI_FORMAT_TEXT;
+	bool sharded = false;
+};
+
+static vector<string> li_workspace();
+static void li_writer_run();
+static li_file_id_s li_file_id(const struct stat& st);
+
+// point index at entries from "from" slot to the end of the list
+static void li_reindex(const int& from)
 {
-	return (this->due == e2.due) && (this->title == e2.title) && (this->description == e2.description);
+	for (int i = from; i < (int)t_list.size(); i++)
+		li_index[t_list.at(i).id] = i;
 }
 
-void li_load()
+// give an entry an ID that is not used yet.
+// Entries from files written before IDs existed get an ID derived from their
+// contents, so that every process loading the same file agrees on it
+static void li_assign_id(noaftodo_entry& li_entry, const bool& from_contents)
 {
-	log("Loading list file " + li_filename);
+	static mt19937_64 rng(random_device{}());
 
-	t_list.clear();
-	t_tags.clear();
+	if (from_contents)
+	{
+		// FNV-1a
+		uint64_t hash = 14695981039346656037ULL;
+		const auto hash_bytes = [&hash](const char* data, const size_t& length)
+		{
+			for (size_t i = 0; i < length; i++)
+			{
+				hash ^= (unsigned char)data[i];
+				hash *= 1099511628211ULL;
+			}
+		};
+
+		hash_bytes((const char*)&li_entry.due, sizeof(li_entry.due));
+		hash_bytes(li_entry.title.data(), li_entry.title.length());
+		hash_bytes("\\", 1);
+		const string_view description = li_description(li_entry);
+		hash_bytes(description.data(), description.length());
+
+		li_entry.id = hash;
+	} else li_entry.id = rng();
+
+	while ((li_entry.id == 0) || (li_index.count(li_entry.id) != 0))
+		li_entry.id = from_contents ? li_entry.id + 1 : rng();
+}
+
+li_pool_s::~li_pool_s()
+{
+	if (fd != -1) close(fd);
+}
 
-	// check if file exists
-	ifstream ifile(li_filename);
-	if (!ifile.good())
+// copy bytes into the pool
+static const char* li_pool_copy(li_pool_s& pool, const char* data, const size_t& size)
+{
+	if (size > pool.free)
 	{
-		// create list file
-		log("File does not exist!", LP_ERROR);
-		log("Creating...");
-		ofstream ofile(li_filename);
-		ofile << "# noaftodo list file" << endl;
-		if (ofile.good()) log("Created");
-		else log("Uh oh file not created", LP_ERROR);
-		ofile.close();
-	} else {
-		// load the list
-		string entry;
-		int mode = 0; 	// -1 - nothing
-				// 0 - list tags read
-				// 1 - lists read
-				// 2 - workspace read
+		if (size > LI_POOL_BLOCK / 4)
+		{	// big chunks get a block of their own
+			pool.blocks.emplace_back(new char[size]);
+			memcpy(pool.blocks.back().get(), data, size);
+			return pool.blocks.back().get();
+		}
+
+		pool.blocks.emplace_back(new char[LI_POOL_BLOCK]);
+		pool.next = pool.blocks.back().get();
+		pool.free = LI_POOL_BLOCK;
+	}
+
+	char* ret = pool.next;
+	memcpy(ret, data, size);
+	pool.next += size;
+	pool.free -= size;
 
-		while (getline(ifile, entry))
+	return ret;
+}
+
+// read a description left in the list file
+static string li_desc_read(const li_pool_s& pool, const noaftodo_entry& li_entry)
+{
+	string ret(li_entry.desc_length, '\0');
+
+	for (size_t done = 0; done < ret.length(); )
+	{
+		const ssize_t status = pread(pool.fd, ret.data() + done, ret.length() - done, li_entry.desc_offset + done);
+		if ((status < 0) && (errno == EINTR)) continue;
+		if (status <= 0)
 		{
-			int token = 0;
-			noaftodo_entry li_entry;
-			string temp = "";
+			log("Failed to read a task description from the list file", LP_ERROR);
+			ret.resize(done);
+			break;
+		}
+
+		done += status;
+	}
+
+	return ret;
+}
+
+// description to write out. Descriptions left on disk are not cached
+// for that: saving should not pull all of them into memory
+static string_view li_desc_save(const noaftodo_entry& li_entry, string& buffer)
+{
+	if (li_entry.desc_offset < 0) return li_entry.description;
+
+	const auto cached = li_pool->descriptions.find(li_entry.desc_offset);
+	if (cached != li_pool->descriptions.end()) return cached->second;
+
+	buffer = li_desc_read(*li_pool, li_entry);
+	return buffer;
+}
+
+// list file line of the entry
+static string li_entry_line(const noaftodo_entry& li_entry, string_view description)
+{
+	string ret = li_entry.completed ? "v\\" : "-\\";
+	ret += to_string(li_entry.due) + '\\';
+	ret += li_entry.title;
+	ret += '\\';
+	ret += description;
+	ret += '\\' + to_string(li_entry.tag) + '\\' + to_string(li_entry.id) + '\\';
+
+	return ret;
+}
+
+// hand the change to the writer - either as a journal record or as a
+// request to write the whole list. Empty record means the latter
+static void li_write_request(const string& record)
+{
+	lock_guard<mutex> lock(li_writer.lock);
+
+	if (record.empty()) li_writer.snapshot = true;
+	else li_writer.records.push_back(record);
+
+	// cvars are not touched from the writer thread
+	li_writer.workspace = li_workspace();
+	li_writer.delay = conf_get_cvar_int("autosave_delay");
+	li_writer.journal_limit = conf_get_cvar_int("journal_limit");
+
+	if (!li_writer.worker.joinable()) li_writer.worker = thread(li_writer_run);
 
-			if (entry != "") // only non-empty lines
+	li_writer.cv.notify_all();
+}
+
+// save the change - either as a journal record or as a whole list.
+// Empty record - always the whole list. A bulk edit is saved once, as
+// a whole list, in li_bulk_end()
+static void li_commit(const string& record)
+{
+	if (!li_autosave) return;
+
+	if (li_bulk > 0) li_unsaved = true;
+	else if ((conf_get_cvar("journal") == "true") && !li_sharded) li_write_request(record);
+	else li_write_request("");
+}
+
+// tell the daemon about the change, so that it can apply it on its own.
+// Op is the journal record type of the change. Bulk edits are too big
+// for that: the daemon is told to read the list once in the end
+static void li_notify(const char& op, const noaftodo_entry& li_entry)
+{
+	if (li_bulk > 0)
+	{
+		li_pending_reload = true;
+		return;
+	}
+
+	da_message_s message;
+	message.op = op;
+	message.generation = li_generation;
+	message.changes = li_changes;
+	message.id = li_entry.id;
+	message.due = li_entry.due;
+	message.tag = li_entry.tag;
+	message.completed = li_entry.completed;
+
+	const string_view title = li_entry.title;
+	const string_view description = li_description(li_entry);
+	if (title.length() + description.length() <= sizeof(message.strings))
+	{
+		message.lengths[0] = title.length();
+		message.lengths[1] = description.length();
+		title.copy(message.strings, title.length());
+		description.copy(message.strings + title.length(), description.length());
+	} else message.truncated = 1;
+
+	da_send(message);
+}
+
+string li_abs_filename(const string& filename)
+{
+	if (filename.empty() || (filename.at(0) == '/')) return filename;
+
+	char cwd[PATH_MAX];
+	if (getcwd(cwd, sizeof(cwd)) == nullptr) return filename;
+
+	return string(cwd) + '/' + filename;
+}
+
+// tell the daemon which file was written and what's in it,
+// so that it does not read a file it already knows the contents of
+static void li_announce(const string& filename, const li_file_id_s& file, const li_snapshot_s& snapshot)
+{
+	const string path = li_abs_filename(filename);
+
+	da_message_s message;
+	message.op = DA_OP_SAVED;
+	message.generation = snapshot.generation;
+	message.base = snapshot.base;
+	message.changes = snapshot.changes;
+	message.format = snapshot.format;
+	message.sharded = snapshot.sharded;
+	message.file = file;
+
+	if (path.length() > sizeof(message.strings)) return;
+	message.lengths[0] = path.length();
+	path.copy(message.strings, path.length());
+
+	da_send(message);
+}
+
+// parse the list file contents in one pass. Lines are sliced out of the
+// buffer in place, only the resulting fields are copied.
+// Lazy - data is the whole file, descriptions are left in it
+static void li_parse(const char* data, const size_t size, const bool& lazy)
+{
+	int mode = 0; 	// -1 - nothing
+			// 0 - list tags read
+			// 1 - lists read
+			// 2 - workspace read
+			// 3 - shards read
+
+	const char* const end = data + size;
+	const char* line = data;
+	while (line < end)
+	{
+		const char* eol = (const char*)memchr(line, '\n', end - line);
+		if (eol == nullptr) eol = end;
+
+		string_view entry(line, eol - line);
+		line = eol + 1;
+
+		// trim string, skip empty lines
+		const size_t start = entry.find_first_not_of(' ');
+		if (start == string_view::npos) continue;
+		entry.remove_prefix(start);
+
+		if (entry.at(0) == '#')
+		{
+			constexpr string_view gen_prefix = "# generation ";
+			if (entry.substr(0, gen_prefix.length()) == gen_prefix)
+				from_chars(entry.data() + gen_prefix.length(), entry.data() + entry.length(), li_generation);
+			if (entry == "# format binary") li_format = LI_FORMAT_BINARY;
+		} else if (entry.at(0) == '[')
+		{
+			if (entry == "[tags]") mode = 0;
+			if (entry == "[list]") mode = 1;
+			if (entry == "[workspace]") mode = 2;
+			if (entry == "[shards]")
+			{
+				mode = 3;
+				li_sharded = true;
+			}
+		} else {
+			if (mode == 0) t_tags.emplace_back(entry);
+			if (mode == 1)
 			{
-				// trim string
-				while (entry.at(0) == ' ') 
+				noaftodo_entry li_entry = li_parse_entry(entry);
+				li_entry.title = li_intern(li_entry.title);
+
+				if (lazy && !li_entry.description.empty())
 				{
-					entry = entry.substr(1);
-					if (entry == "") break;
-				}
+					li_entry.desc_offset = li_entry.description.data() - data;
+					li_entry.desc_length = li_entry.description.length();
+					li_entry.description = "";
+				} else li_entry.description = li_intern(li_entry.description);
 
-				if (entry != "") if (entry.at(0) != '#')
+				t_list.push_back(li_entry);
+			}
+			if ((mode == 2) && li_exec_workspace) cmd_exec(string(entry));
+			if (mode == 3)
+			{
+				int tag = -1;
+				from_chars(entry.data(), entry.data() + entry.length(), tag);
+				if (tag >= 0)
 				{
-					log(entry);
-
-					if (entry.at(0) == '[')
-					{
-						if (entry == "[tags]") mode = 0;
-						if (entry == "[list]") mode = 1;
-						if (entry == "[workspace]") mode = 2;
-					} else {
-						if (mode == 0)
-						{
-							log("Added tag \"" + entry + "\" with index " + to_string(t_tags.size()));
-							t_tags.push_back(entry);
-						}
-
-						if (mode == 1)
-						{
-							for (int i = 0; i < entry.length(); i++)
-							{
-								if (entry.at(i) == '\\')
-								{
-									switch (token)
-									{
-										case 0:
-											li_entry.completed = (temp == "v");
-											break;
-										case 1:
-											li_entry.due = stol(temp);
-											break;
-										case 2:
-											li_entry.title = temp;
-											break;
-										case 3:
-											li_entry.description = temp;
-											break;
-										case 4:
-											li_entry.tag = stoi(temp);
-											break;
-									}
-
-									temp = "";
-									token++;
-								} else temp += entry.at(i);
-							}
-
-							t_list.push_back(li_entry);
-						}
-						
-						if (mode == 2)
-						{
-							while (entry.at(0) == ' ')
-							{
-								entry = entry.substr(1);
-								if (entry == "") break;
-							}
-
-							if (entry != "") if (entry.at(0) != '#')
-								cmd_exec(entry);
-						}
-					}
+					if (tag >= (int)li_shards.size()) li_shards.resize(tag + 1);
+					li_shards.at(tag).exists = true;
 				}
 			}
 		}
 	}
-
-	li_sort();
 }
 
-void li_load(const string& filename)
+// binary list file layout:
+//	li_bin_header
+//	li_bin_string[tag_count]	- tag names
+//	li_bin_entry[entry_count]	- the list
+//	li_bin_string[ws_count]		- workspace commands
+//	char[heap_size]			- all the strings
+struct li_bin_header
 {
-	li_filename = filename;
-	li_load();
+	char magic[8];
+	uint32_t version;
+	uint32_t tag_count;
+	uint32_t entry_count;
+	uint32_t ws_count;
+	int64_t generation;
+	uint64_t heap_size;
+};
+
+struct li_bin_string
+{
+	uint32_t offset;
+	uint32_t length;
+};
+
+struct li_bin_entry
+{
+	int64_t due;
+	int32_t tag;
+	uint8_t completed;
+	uint8_t reserved[3];
+	li_bin_string title;
+	li_bin_string description;
+	uint64_t id;		// since version 2
+};
+
+// version 1 records end before the ID
+constexpr size_t LI_BIN_ENTRY_V1_SIZE = offsetof(li_bin_entry, id);
+
+// load the binary list file. Nothing is parsed: records are read in place
+// and strings are sliced out of the heap.
+// Lazy - data is the whole file, descriptions are left in it
+static bool li_parse_bin(const char* data, const size_t size, const bool& lazy)
+{
+	if (size < sizeof(li_bin_header))
+	{
+		log("Binary list file is truncated", LP_ERROR);
+		return false;
+	}
+
+	li_bin_header header;
+	memcpy(&header, data, sizeof(header));
+
+	if ((header.version < 1) || (header.version > LI_BIN_VERSION))
+	{
+		log("Unsupported binary list file version " + to_string(header.version), LP_ERROR);
+		return false;
+	}
+
+	const size_t tags_offset = sizeof(li_bin_header);
+	const size_t entry_size = (header.version == 1) ? LI_BIN_ENTRY_V1_SIZE : sizeof(li_bin_entry);
+	const size_t entries_offset = tags_offset + (size_t)header.tag_count * sizeof(li_bin_string);
+	const size_t ws_offset = entries_offset + (size_t)header.entry_count * entry_size;
+	const size_t heap_offset = ws_offset + (size_t)header.ws_count * sizeof(li_bin_string);
+
+	if ((heap_offset > size) || (header.heap_size > size - heap_offset))
+	{
+		log("Binary list file is truncated", LP_ERROR);
+		return false;
+	}
+
+	// strings of the list live in one copy of the heap.
+	// Without descriptions it is mostly empty, so titles are copied one by one
+	const char* heap = lazy ? (data + heap_offset) : li_pool_copy(*li_pool, data + heap_offset, header.heap_size);
+	bool heap_ok = true;
+	const auto heap_str = [&](const li_bin_string& str)
+	{
+		if ((uint64_t)str.offset + str.length > header.heap_size)
+		{
+			heap_ok = false;
+			return string_view();
+		}
+
+		return string_view(heap + str.offset, str.length);
+	};
+
+	t_tags.reserve(header.tag_count);
+	for (uint32_t i = 0; i < header.tag_count; i++)
+	{
+		li_bin_string tag;
+		memcpy(&tag, data + tags_offset + i * sizeof(li_bin_string), sizeof(tag));
+		t_tags.emplace_back(heap_str(tag));
+	}
+
+	t_list.reserve(header.entry_count);
+	for (uint32_t i = 0; i < header.entry_count; i++)
+	{
+		li_bin_entry record = { };
+		memcpy(&record, data + entries_offset + i * entry_size, entry_size);
+
+		noaftodo_entry li_entry;
+		li_entry.completed = record.completed;
+		li_entry.due = record.due;
+		li_entry.title = heap_str(record.title);
+		li_entry.description = heap_str(record.description);
+		li_entry.tag = record.tag;
+
+		if (lazy)
+		{
+			li_entry.title = li_intern(li_entry.title);
+
+			if (!li_entry.description.empty())
+			{
+				li_entry.desc_offset = heap_offset + record.description.offset;
+				li_entry.desc_length = record.description.length;
+				li_entry.description = "";
+			}
+		}
+
+		li_entry.id = record.id;
+
+		t_list.push_back(li_entry);
+	}
+
+	li_generation = header.generation;
+
+	for (uint32_t i = 0; li_exec_workspace && (i < header.ws_count); i++)
+	{
+		li_bin_string command;
+		memcpy(&command, data + ws_offset + i * sizeof(li_bin_string), sizeof(command));
+		cmd_exec(string(heap_str(command)));
+	}
+
+	if (!heap_ok) log("Binary list file has strings out of bounds", LP_ERROR);
+
+	return heap_ok;
 }
 
-void li_save()
+// pick the parser by the file magic. False if the file is damaged
+static bool li_parse_any(const char* data, const size_t size, const bool& lazy)
 {
-	ofstream ofile;
-	ofile.open(li_filename, ios::out | ios::trunc);
+	const auto start = chrono::steady_clock::now();
+	bool ret = true;
 
-	ofile << "# naftodo list file" << endl;
+	if ((size >= sizeof(LI_BIN_MAGIC)) && (memcmp(data, LI_BIN_MAGIC, sizeof(LI_BIN_MAGIC)) == 0))
+	{
+		li_format = LI_FORMAT_BINARY;
+		ret = li_parse_bin(data, size, lazy);
+	} else if (memchr(data, '\0', min(size, sizeof(li_bin_header))) != nullptr)
+	{
+		// text has no zero bytes, a binary header does: a binary file with its magic damaged
+		li_format = LI_FORMAT_TEXT;
+		log("List file is damaged: it's not text, and not a binary list file", LP_ERROR);
+		ret = false;
+	} else {
+		li_format = LI_FORMAT_TEXT;
+		li_parse(data, size, lazy);
+	}
 
-	ofile << "[tags]" << endl << "# tags start at index 0 and go on" << endl;
-	for (const auto& tag : t_tags)
-		ofile << tag << endl;
+	st_time("list.parse", start);
 
-	ofile << endl << "[list]" << endl;
-	for (const auto& entry : t_list)
-		ofile << (entry.completed ? 'v' : '-') << '\\' << entry.due << '\\' << entry.title << '\\' << entry.description << '\\' << entry.tag << '\\' << endl;
+	return ret;
+}
+
+// workspace commands saved with the list: cvars that differ from the config
+static vector<string> li_workspace()
+{
+	vector<string> ret;
 
-	ofile << endl << "[workspace]" << endl;
 	for (map<string, string>::iterator cvar_i = conf_cvars.begin(); cvar_i != conf_cvars.end(); cvar_i++)
 	{
 		const string key = cvar_i->first;
 		if (conf_get_predefined_cvar(key) != conf_get_cvar(key))
-			ofile << "set \"" << key << "\" \"" << conf_cvars.at(key) << "\"" << endl;
+			ret.push_back("set \"" + key + "\" \"" + conf_cvars.at(key) + "\"");
 	}
 
-	log("Changes written to file " + li_filename);
+	return ret;
 }
 
-void li_save(const string& filename)
+bool li_write_atomic(const string& filename, const string& contents, const function<void(const li_file_id_s&)>& before_rename, const int& mode)
 {
-	li_filename = filename;
-	li_save();
+	string tmp_filename = filename + ".XXXXXX";
+	const int fd = mkstemp(tmp_filename.data());
+	if (fd == -1) return false;
+
+	bool ok = true;
+	for (size_t written = 0; ok && (written < contents.length()); )
+	{
+		const ssize_t status = write(fd, contents.data() + written, contents.length() - written);
+		if (status < 0) ok = (errno == EINTR);
+		else written += status;
+	}
+
+	// mkstemp creates files only the owner can read
+	struct stat st;
+	if (stat(filename.c_str(), &st) == 0) fchmod(fd, st.st_mode & 07777);
+	else fchmod(fd, mode);
+
+	ok = ok && (fsync(fd) == 0);
+	ok = ok && (fstat(fd, &st) == 0);
+	ok = (close(fd) == 0) && ok;
+
+	if (ok && before_rename) before_rename(li_file_id(st));
+	ok = ok && (rename(tmp_filename.c_str(), filename.c_str()) == 0);
+
+	if (!ok)
+	{
+		remove(tmp_filename.c_str());
+		return false;
+	}
+
+	// the rename itself has to reach the disk, or a crash can bring back the old file
+	const size_t slash = filename.rfind('/');
+	const string dir = (slash == string::npos) ? "." : filename.substr(0, slash + 1);
+	const int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dir_fd != -1)
+	{
+		fsync(dir_fd);
+		close(dir_fd);
+	}
+
+	return true;
 }
 
-void li_add(const noaftodo_entry& li_entry)
+// shard - LI_SHARD_ALL or the tag to write the entries of
+static string li_serialize_bin(const vector<string>& workspace, const int& shard)
 {
-	log("Adding " + li_entry.title + "...");
-	t_list.push_back(li_entry);
+	// equal strings are stored once
+	string heap;
+	unordered_map<string_view, li_bin_string> heap_strings;
+	unordered_map<int64_t, li_bin_string> heap_descriptions;	// descriptions left on disk, by offset
+	const auto heap_add = [&](string_view str)
+	{
+		const li_bin_string ret = { (uint32_t)heap.length(), (uint32_t)str.length() };
+		heap += str;
+		return ret;
+	};
+	const auto heap_str = [&](string_view str)
+	{
+		const auto it = heap_strings.find(str);
+		if (it != heap_strings.end()) return it->second;
+
+		return heap_strings[str] = heap_add(str);
+	};
+
+	// shards have only the entries
+	const bool whole = (shard == LI_SHARD_ALL);
+
+	vector<li_bin_string> tags;
+	if (whole)
+		for (const auto& tag : t_tags)
+			tags.push_back(heap_str(tag));
+
+	vector<li_bin_entry> entries;
+	vector<const noaftodo_entry*> sources;
+	if (whole) entries.reserve(t_list.size());
+	for (const auto& entry : t_list)
+	{
+		if (!whole && (entry.tag != shard)) continue;
+
+		sources.push_back(&entry);
+
+		li_bin_entry record = { };
+		record.due = entry.due;
+		record.tag = entry.tag;
+		record.completed = entry.completed;
+		record.title = heap_str(entry.title);
+		record.id = entry.id;
+		entries.push_back(record);
+	}
+
+	// descriptions go after all the titles, so that loading the file
+	// without them does not touch their pages
+	string buffer;
+	for (int i = 0; i < (int)entries.size(); i++)
+	{
+		const auto& entry = *sources.at(i);
+
+		if (entry.desc_offset < 0) entries.at(i).description = heap_str(entry.description);
+		else {
+			const auto it = heap_descriptions.find(entry.desc_offset);
+			if (it != heap_descriptions.end()) entries.at(i).description = it->second;
+			else entries.at(i).description = heap_descriptions[entry.desc_offset] = heap_add(li_desc_save(entry, buffer));
+		}
+	}
+
+	vector<li_bin_string> commands;
+	if (whole)
+		for (const auto& command : workspace)
+			commands.push_back(heap_str(command));
 
-	li_sort(); // will also autosave
+	li_bin_header header = { };
+	memcpy(header.magic, LI_BIN_MAGIC, sizeof(header.magic));
+	header.version = LI_BIN_VERSION;
+	header.tag_count = tags.size();
+	header.entry_count = entries.size();
+	header.ws_count = commands.size();
+	header.generation = li_generation;
+	header.heap_size = heap.length();
 
-	da_send("A");
+	string contents;
+	contents.reserve(sizeof(header) + tags.size() * sizeof(li_bin_string) + entries.size() * sizeof(li_bin_entry) + commands.size() * sizeof(li_bin_string) + heap.length());
+	contents.append((const char*)&header, sizeof(header));
+	contents.append((const char*)tags.data(), tags.size() * sizeof(li_bin_string));
+	contents.append((const char*)entries.data(), entries.size() * sizeof(li_bin_entry));
+	contents.append((const char*)commands.data(), commands.size() * sizeof(li_bin_string));
+	contents += heap;
+
+	return contents;
 }
 
-void li_comp(const int& entryID)
+// shard - LI_SHARD_ALL, LI_SHARD_MANIFEST or the tag to write the entries of
+static string li_serialize_text(const vector<string>& workspace, const int& shard)
 {
-	if ((entryID < 0) || (entryID >= t_list.size()))
+	string contents = "# naftodo list file\n";
+	contents += "# generation " + to_string(li_generation) + '\n';
+
+	if (shard < 0)
 	{
-		log("li_comp: entry ID out of list bounds. Operation aborted", LP_ERROR);
-		return;
+		contents += "[tags]\n# tags start at index 0 and go on\n";
+		for (const auto& tag : t_tags)
+			(contents += tag) += '\n';
+	}
+
+	if (shard == LI_SHARD_MANIFEST)
+	{
+		// lists are stored in <list file>.<tag> files in this format
+		if (li_format == LI_FORMAT_BINARY) contents += "# format binary\n";
+
+		contents += "\n[shards]\n";
+		for (int tag = 0; tag < (int)li_shards.size(); tag++)
+			if (li_shards.at(tag).exists)
+				contents += to_string(tag) + '\n';
+	} else {
+		contents += "\n[list]\n";
+		string buffer;
+		for (const auto& entry : t_list)
+			if ((shard == LI_SHARD_ALL) || (entry.tag == shard))
+				(contents += li_entry_line(entry, li_desc_save(entry, buffer))) += '\n';
+	}
+
+	if (shard < 0)
+	{
+		contents += "\n[workspace]\n";
+		for (const auto& command : workspace)
+			(contents += command) += '\n';
 	}
 
-	t_list.at(entryID).completed = !t_list.at(entryID).completed;
+	return contents;
+}
 
-	if (li_autosave) li_save();
+// what the list files would be now, without making a new generation
+static li_snapshot_s li_snapshot_now()
+{
+	li_snapshot_s ret;
+	ret.generation = li_generation;
+	ret.base = li_generation;
+	ret.changes = li_changes;
+	ret.format = li_format;
+	ret.sharded = li_sharded;
 
-	da_send("C");
+	return ret;
 }
 
-void li_rem(const int& entryID)
+// the next generation of the list file: filenames and their contents.
+// Caller holds li_mutex
+static li_snapshot_s li_snapshot(const vector<string>& workspace)
 {
-	if ((entryID < 0) || (entryID >= t_list.size()))
+	li_snapshot_s ret = li_snapshot_now();
+
+	li_generation++;
+	li_changes = 0;
+	ret.generation = li_generation;
+
+	auto& files = ret.files;
+
+	if (li_sharded)
 	{
-		log("li_rem: entry ID out of list bounds. Operation aborted", LP_ERROR);
-		return;
+		// only the lists that changed, then the manifest
+		for (int tag = 0; tag < (int)li_shards.size(); tag++)
+		{
+			auto& shard = li_shards.at(tag);
+			if (!shard.dirty) continue;
+
+			files.emplace_back(li_shard_filename(tag), (li_format == LI_FORMAT_BINARY) ? li_serialize_bin(workspace, tag) : li_serialize_text(workspace, tag));
+			shard.dirty = false;
+		}
+
+		files.emplace_back(li_filename, li_serialize_text(workspace, LI_SHARD_MANIFEST));
+	} else files.emplace_back(li_filename, (li_format == LI_FORMAT_BINARY) ? li_serialize_bin(workspace, LI_SHARD_ALL) : li_serialize_text(workspace, LI_SHARD_ALL));
+
+	return ret;
+}
+
+// write a snapshot made by li_snapshot(). Caller holds li_disk_mutex
+static bool li_write_snapshot(const li_snapshot_s& snapshot)
+{
+	for (const auto& file : snapshot.files)
+		if (!li_write_atomic(file.first, file.second, [&](const li_file_id_s& id) { li_announce(file.first, id, snapshot); }))
+		{
+			log("Failed to write " + file.first, LP_ERROR);
+			return false;
+		}
+
+	// the snapshot now contains everything the journal had
+	const string j_filename = snapshot.files.back().first + LI_JOURNAL_SUFFIX;
+	li_announce(j_filename, li_file_id_s(), snapshot);
+	remove(j_filename.c_str());
+
+	return true;
+}
+
+// drop a record a crash cut short, so that the next one starts on a line of its own
+static void li_journal_trim(const int& fd, const off_t& size)
+{
+	char last;
+	if ((size == 0) || ((pread(fd, &last, 1, size - 1) == 1) && (last == '\n'))) return;
+
+	// after the last whole line
+	off_t end = size;
+	char buffer[4096];
+	while (end > 0)
+	{
+		const off_t from = max<off_t>(0, end - sizeof(buffer));
+		const ssize_t length = pread(fd, buffer, end - from, from);
+		if (length != end - from)
+		{
+			if ((length < 0) && (errno == EINTR)) continue;
+			return;
+		}
+
+		ssize_t eol = length - 1;
+		while ((eol >= 0) && (buffer[eol] != '\n')) eol--;
+
+		end = from + eol + 1;
+		if (eol >= 0) break;
 	}
 
-	log("Removing " + t_list.at(entryID).title + "...");
-	t_list.erase(t_list.begin() + entryID);
+	if (ftruncate(fd, end) == 0) log("Journal ended with a record cut short. Dropped it", LP_ERROR);
+}
 
-	li_sort();
+// append records to the journal and sync it. Caller holds li_disk_mutex
+static bool li_journal_write(const string& filename, const li_snapshot_s& snapshot, const vector<string>& records, off_t& size)
+{
+	const long& generation = snapshot.generation;
+
+	const string j_filename = filename + LI_JOURNAL_SUFFIX;
+
+	const int fd = open(j_filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (fd == -1) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0) li_journal_trim(fd, st.st_size);
+
+	string contents;
+	// a fresh journal remembers which snapshot it applies to
+	if ((fstat(fd, &st) == 0) && (st.st_size == 0))
+		contents = "# generation " + to_string(generation) + '\n';
 
-	da_send("R");
+	for (const auto& record : records)
+		(contents += record) += '\n';
+
+	bool ok = true;
+	for (size_t written = 0; ok && (written < contents.length()); )
+	{
+		const ssize_t status = write(fd, contents.data() + written, contents.length() - written);
+		if (status < 0) ok = (errno == EINTR);
+		else written += status;
+	}
+
+	ok = ok && (fdatasync(fd) == 0);
+	ok = ok && (fstat(fd, &st) == 0);
+
+	// before closing it: the daemon wakes up on that
+	if (ok) li_announce(j_filename, li_file_id(st), snapshot);
+
+	ok = (close(fd) == 0) && ok;
+
+	size = st.st_size;
+
+	return ok;
 }
 
-void li_sort()
+// write everything the writer was handed so far
+static void li_write_pending()
 {
-	std::sort(t_list.begin(), t_list.end(), less_than_noaftodo_entry());
+	lock_guard<mutex> disk_lock(li_disk_mutex);
+
+	string filename;
+	bool snapshot;
+	vector<string> records;
+	li_snapshot_s files;
+	int journal_limit;
+
+	// take the changes and serialize the list in one go, so that
+	// no change ends up both in the snapshot and in the records
+	const auto take = [&]()
+	{
+		lock_guard<recursive_mutex> list_lock(li_mutex);
+		lock_guard<mutex> lock(li_writer.lock);
 
-	if (li_autosave) li_save();
+		filename = li_filename;
+		snapshot = li_writer.snapshot;
+		journal_limit = li_writer.journal_limit;
+		li_writer.snapshot = false;
+		records.clear();
+		records.swap(li_writer.records);
+
+		// the snapshot has the records in it
+		files = snapshot ? li_snapshot(li_writer.workspace) : li_snapshot_now();
+	};
+
+	take();
+
+	if (!snapshot)
+	{
+		if (records.empty()) return;
+
+		off_t size = 0;
+		if (li_journal_write(filename, files, records, size))
+		{
+			// fold the journal back into the list file once it gets too big
+			if (size <= journal_limit) return;
+		} else log("Failed to append to " + filename + LI_JOURNAL_SUFFIX + ". Writing the whole list instead", LP_ERROR);
+
+		{
+			lock_guard<mutex> lock(li_writer.lock);
+			li_writer.snapshot = true;
+		}
+		take();
+	}
+
+	li_write_snapshot(files);
+}
+
+static void li_writer_run()
+{
+	unique_lock<mutex> lock(li_writer.lock);
+
+	while (true)
+	{
+		li_writer.cv.wait(lock, [] { return li_writer.stop || li_writer.snapshot || !li_writer.records.empty(); });
+		if (!li_writer.snapshot && li_writer.records.empty()) break;
+
+		// let the changes that follow shortly after be written together
+		if (li_writer.delay > 0)
+			li_writer.cv.wait_for(lock, chrono::milliseconds(li_writer.delay), [] { return li_writer.stop; });
+
+		lock.unlock();
+		li_write_pending();
+		lock.lock();
+	}
+}
+
+// a list file that can't be read in full would be written over by the
+// next save with what could be read: it's moved out of the way first.
+// If it can't be moved, the directory is not writable and it's not saved over either
+static void li_set_aside(const string& filename)
+{
+	const string aside = filename + LI_DAMAGED_SUFFIX;
+	if (rename(filename.c_str(), aside.c_str()) == 0)
+		log("List file " + filename + " is damaged. It's moved to " + aside + ", the tasks that could be read are saved anew", LP_ERROR);
+	else log("List file " + filename + " is damaged and can't be moved aside", LP_ERROR);
+}
+
+// parse a list file into t_list and t_tags. False if it can't be opened.
+// Lazy - descriptions are left in the file, li_pool keeps it open
+static bool li_read(const string& filename, const bool& lazy, struct stat& st)
+{
+	const int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1) return false;
+
+	bool parsed = true;
+	if ((fstat(fd, &st) == 0) && (st.st_size > 0))
+	{
+		void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED)
+		{
+			madvise(data, st.st_size, MADV_SEQUENTIAL);
+			parsed = li_parse_any((const char*)data, st.st_size, lazy);
+			munmap(data, st.st_size);
+
+			// descriptions are read from the file later
+			if (lazy) li_pool->fd = fd;
+		} else {
+			// can't map it (e.g. not a regular file) - read it instead
+			ifstream ifile(filename, ios::in | ios::binary);
+			const string contents((istreambuf_iterator<char>(ifile)), istreambuf_iterator<char>());
+			parsed = li_parse_any(contents.data(), contents.length(), false);
+		}
+	}
+
+	if (li_pool->fd != fd) close(fd);
+
+	if (!parsed) li_set_aside(filename);
+
+	return true;
+}
+
+// index entries from "from" slot on, giving IDs to the ones without
+static void li_index_from(const int& from)
+{
+	for (int i = from; i < (int)t_list.size(); i++)
+	{
+		auto& entry = t_list.at(i);
+		if ((entry.id == 0) || (li_index.count(entry.id) != 0))
+			li_assign_id(entry, true);
+
+		li_index[entry.id] = i;
+	}
+}
+
+static li_file_id_s li_file_id(const struct stat& st)
+{
+	li_file_id_s ret;
+	ret.ino = st.st_ino;
+	ret.size = st.st_size;
+	ret.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+
+	return ret;
+}
+
+static li_file_id_s li_file_id(const string& filename)
+{
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0) return li_file_id_s();
+
+	return li_file_id(st);
+}
+
+// the file is the one loaded, or the one an announced file is about to be renamed over
+static bool li_file_same(const string& filename, const li_file_id_s& file, const li_file_id_s& loaded)
+{
+	if (file == loaded) return true;
+
+	const auto replaced = li_replaced.find(li_abs_filename(filename));
+	return (replaced != li_replaced.end()) && (replaced->second == file);
+}
+
+// keep the lists loaded before li_load() whose files have not changed
+static void li_shards_keep(const vector<li_shard_s>& old_shards, const vector<noaftodo_entry>& old_list)
+{
+	vector<bool> keep(old_shards.size(), false);
+
+	for (int tag = 0; (tag < (int)old_shards.size()) && (tag < (int)li_shards.size()); tag++)
+	{
+		const auto& shard = old_shards.at(tag);
+		if (!shard.loaded || shard.dirty || !li_shards.at(tag).exists) continue;
+
+		if (!(li_file_id(li_shard_filename(tag)) == shard.file)) continue;
+
+		li_shards.at(tag) = shard;
+		li_pool->shards.push_back(shard.pool);
+		keep.at(tag) = true;
+	}
+
+	for (const auto& entry : old_list)
+		if ((entry.tag >= 0) && (entry.tag < (int)keep.size()) && keep.at(entry.tag))
+			t_list.push_back(entry);
+}
+
+static void li_shard_load(const int& tag)
+{
+	if (tag >= (int)li_shards.size()) li_shards.resize(tag + 1);
+	if (li_shards.at(tag).loaded) return;
+
+	// strings of the list live as long as the list stays loaded
+	auto pool = make_shared<li_pool_s>();
+	li_pool->shards.push_back(pool);
+	li_shards.at(tag).loaded = true;
+	li_shards.at(tag).pool = pool;
+
+	if (!li_shards.at(tag).exists) return;
+
+	// the manifest has the say on these
+	const long generation = li_generation;
+	const int format = li_format;
+	const int from = t_list.size();
+
+	swap(li_pool, pool);
+	struct stat st;
+	const bool ok = li_read(li_shard_filename(tag), false, st);
+	swap(li_pool, pool);
+
+	li_generation = generation;
+	li_format = format;
+
+	if (!ok)
+	{
+		log("List file " + li_shard_filename(tag) + " is missing", LP_ERROR);
+		return;
+	}
+
+	li_shards.at(tag).file = li_file_id(st);
+
+	li_index_from(from);
+
+	// lists are sorted on their own - merge it in
+	stable_sort(t_list.begin() + from, t_list.end(), less_than_noaftodo_entry());
+	inplace_merge(t_list.begin(), t_list.begin() + from, t_list.end(), less_than_noaftodo_entry());
+	li_sort();
+
+	log("Loaded " + to_string(t_list.size() - from) + " tasks of list " + to_string(tag));
+}
+
+// the list of the tag has changes to write
+static void li_shard_touch(const int& tag)
+{
+	if (!li_sharded || (tag < 0)) return;
+
+	// never write a list that was only partly loaded
+	li_shard_load(tag);
+
+	li_shards.at(tag).exists = true;
+	li_shards.at(tag).dirty = true;
+}
+
+// every list has to be written again
+static void li_shard_touch_all()
+{
+	for (int tag = 0; tag < (int)t_tags.size(); tag++)
+		li_shard_touch(tag);
+	for (const auto& entry : t_list)
+		li_shard_touch(entry.tag);
+}
+
+bool li_load()
+{
+	// changes still on their way to the old file go there first
+	li_flush();
+
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	// the daemon calls this every tick, and most of the time nothing changed
+	const li_file_id_s file = li_file_id(li_filename);
+	const li_file_id_s journal = li_file_id(li_filename + LI_JOURNAL_SUFFIX);
+	if (!li_modified && (li_loaded_of == li_filename) && (file.size >= 0) &&
+			li_file_same(li_filename, file, li_loaded_file) &&
+			li_file_same(li_filename + LI_JOURNAL_SUFFIX, journal, li_loaded_journal))
+	{
+		bool shards_changed = false;
+		for (int tag = 0; li_sharded && (tag < (int)li_shards.size()); tag++)
+			if (li_shards.at(tag).loaded && li_shards.at(tag).exists)
+				shards_changed = shards_changed || !li_file_same(li_shard_filename(tag), li_file_id(li_shard_filename(tag)), li_shards.at(tag).file);
+
+		if (!shards_changed) return false;
+	}
+
+	log("Loading list file " + li_filename);
+
+	const bool lazy = (conf_get_cvar("lazy_descriptions") == "true");
+
+	// with the sharded layout, lists that did not change are not read again
+	vector<li_shard_s> old_shards;
+	vector<noaftodo_entry> old_list;
+	if (li_sharded && (li_loaded_of == li_filename))
+	{
+		old_shards.swap(li_shards);
+		old_list.swap(t_list);
+	}
+
+	t_list.clear();
+	t_tags.clear();
+	li_shards.clear();
+	li_sharded = false;
+	li_loaded_of = li_filename;
+	li_loaded_file = file;
+	li_loaded_journal = journal;
+	li_replaced.clear();
+	li_generation = 0;
+	li_changes = 0;
+	li_format = LI_FORMAT_TEXT;
+
+	// strings of the previous generation stay alive only as long as
+	// someone (e.g. the daemon cache) holds that pool
+	li_pool = make_shared<li_pool_s>();
+
+	struct stat st;
+	if (!li_read(li_filename, lazy, st))
+	{
+		// create list file
+		log("File does not exist!", LP_ERROR);
+		log("Creating...");
+		ofstream ofile(li_filename);
+		ofile << "# noaftodo list file" << endl;
+		if (ofile.good()) log("Created");
+		else log("Uh oh file not created", LP_ERROR);
+		ofile.close();
+	} else log("Loaded " + to_string(t_list.size()) + " tasks in " + to_string(t_tags.size()) + " lists");
+
+	if (li_sharded) li_shards_keep(old_shards, old_list);
+
+	li_index.clear();
+	li_index.reserve(t_list.size());
+	li_index_from(0);
+
+	li_sort();
+
+	// the sharded layout has no journal
+	if (!li_sharded) li_journal_replay();
+
+	li_modified = false;
+
+	return true;
+}
+
+bool li_load(const string& filename)
+{
+	li_filename = filename;
+	return li_load();
+}
+
+void li_load_text(const string& contents)
+{
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	t_list.clear();
+	t_tags.clear();
+	li_shards.clear();
+	li_sharded = false;
+	li_loaded_of = "";	// li_load() reads the file in full
+	li_generation = 0;
+	li_changes = 0;
+	li_format = LI_FORMAT_TEXT;
+	li_pool = make_shared<li_pool_s>();
+
+	li_parse_any(contents.data(), contents.length(), false);
+
+	li_index.clear();
+	li_index.reserve(t_list.size());
+	li_index_from(0);
+
+	li_sort();
+
+	li_modified = false;
+}
+
+string li_dump(long& generation, uint32_t& changes)
+{
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	li_shard_need(-1);
+
+	generation = li_generation;
+	changes = li_changes;
+
+	return li_serialize_text(li_workspace(), LI_SHARD_ALL);
+}
+
+void li_save()
+{
+	// the daemon saves its list itself
+	if (sv_remote) return;
+
+	lock_guard<mutex> disk_lock(li_disk_mutex);
+
+	string filename;
+	li_snapshot_s files;
+	{
+		lock_guard<recursive_mutex> list_lock(li_mutex);
+		lock_guard<mutex> lock(li_writer.lock);
+
+		// whatever the writer has not written yet is in this snapshot
+		li_writer.snapshot = false;
+		li_writer.records.clear();
+
+		filename = li_filename;
+		files = li_snapshot(li_workspace());
+	}
+
+	if (li_write_snapshot(files))
+		log("Changes written to file " + filename);
+}
+
+void li_save(const string& filename)
+{
+	li_filename = filename;
+	li_save();
+}
+
+void li_shard_need(const int& tag)
+{
+	if (!li_sharded) return;
+
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	if (tag < 0)
+	{
+		for (int i = 0; i < (int)li_shards.size(); i++)
+			li_shard_load(i);
+	} else li_shard_load(tag);
+}
+
+string li_shard_filename(const int& tag)
+{
+	return li_filename + "." + to_string(tag);
+}
+
+void li_layout(const bool& sharded)
+{
+	if (sharded == li_sharded) return;
+
+	{
+		lock_guard<recursive_mutex> list_lock(li_mutex);
+
+		// every list goes to the new files
+		li_shard_need(-1);
+		li_sharded = sharded;
+		li_shard_touch_all();
+	}
+
+	li_save();
+
+	if (!sharded)
+	{
+		lock_guard<recursive_mutex> list_lock(li_mutex);
+
+		for (int tag = 0; tag < (int)li_shards.size(); tag++)
+			if (li_shards.at(tag).exists) remove(li_shard_filename(tag).c_str());
+
+		li_shards.clear();
+	}
+}
+
+void li_convert(const int& format)
+{
+	{
+		// the writer thread reads it while it serializes the list
+		lock_guard<recursive_mutex> list_lock(li_mutex);
+		li_format = format;
+
+		// the lists that did not change are converted too
+		li_shard_need(-1);
+		li_shard_touch_all();
+	}
+
+	li_save();
+}
+
+void li_flush()
+{
+	unique_lock<mutex> lock(li_writer.lock);
+	if (!li_writer.worker.joinable()) return;
+
+	li_writer.stop = true;
+	li_writer.cv.notify_all();
+	lock.unlock();
+
+	li_writer.worker.join();
+
+	lock.lock();
+	li_writer.stop = false;
+}
+
+void li_swap(li_context_s& context)
+{
+	// the writer works with the list in use
+	li_flush();
+
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	swap(li_ctx, context);
+}
+
+static void li_cols_insert(const int& entryID, const noaftodo_entry& li_entry)
+{
+	li_cols.completed.insert(li_cols.completed.begin() + entryID, li_entry.completed);
+	li_cols.due.insert(li_cols.due.begin() + entryID, li_entry.due);
+	li_cols.tag.insert(li_cols.tag.begin() + entryID, li_entry.tag);
+	li_cols.state.insert(li_cols.state.begin() + entryID, li_state(entryID, li_time.now, li_time.coming));
+}
+
+static void li_do_add(noaftodo_entry li_entry)
+{
+	li_modified = true;
+	li_changes++;
+
+	li_entry.title = li_intern(li_entry.title);
+	li_entry.description = li_intern(li_entry.description);
+
+	if (li_bulk > 0)
+	{	// sort once when the bulk edit ends
+		t_list.push_back(li_entry);
+		li_index[li_entry.id] = t_list.size() - 1;
+		li_cols_insert(t_list.size() - 1, li_entry);
+		li_sorted = false;
+		li_shard_touch(li_entry.tag);
+		return;
+	}
+
+	if (!li_sorted) li_sort();
+
+	// after the entries with the same due, like a stable sort would put it
+	const auto pos = upper_bound(t_list.begin(), t_list.end(), li_entry, less_than_noaftodo_entry());
+	const int entryID = pos - t_list.begin();
+	t_list.insert(pos, li_entry);
+	li_cols_insert(entryID, li_entry);
+
+	li_reindex(entryID);
+
+	li_shard_touch(li_entry.tag);
+}
+
+static void li_do_rem(const int& entryID)
+{
+	li_modified = true;
+	li_changes++;
+
+	const int tag = t_list.at(entryID).tag;
+
+	li_index.erase(t_list.at(entryID).id);
+	t_list.erase(t_list.begin() + entryID);
+
+	li_cols.completed.erase(li_cols.completed.begin() + entryID);
+	li_cols.due.erase(li_cols.due.begin() + entryID);
+	li_cols.tag.erase(li_cols.tag.begin() + entryID);
+	li_cols.state.erase(li_cols.state.begin() + entryID);
+
+	li_reindex(entryID);
+
+	li_shard_touch(tag);
+}
+
+static void li_do_comp(const int& entryID, const bool& completed)
+{
+	li_modified = true;
+	li_changes++;
+
+	t_list.at(entryID).completed = completed;
+	li_cols.completed.at(entryID) = completed;
+	li_cols.state.at(entryID) = li_state(entryID, li_time.now, li_time.coming);
+
+	li_shard_touch(t_list.at(entryID).tag);
+}
+
+static void li_do_mv(const int& entryID, const int& tag)
+{
+	li_modified = true;
+	li_changes++;
+
+	li_shard_touch(t_list.at(entryID).tag);
+
+	t_list.at(entryID).tag = tag;
+	li_cols.tag.at(entryID) = tag;
+
+	li_shard_touch(tag);
+}
+
+static void li_do_rename(const int& tag, const string& name)
+{
+	li_modified = true;
+	li_changes++;
+
+	while (tag >= (int)t_tags.size()) t_tags.push_back(to_string(t_tags.size()));
+
+	t_tags[tag] = name;
+}
+
+void li_add(const noaftodo_entry& li_entry)
+{
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	log("Adding " + string(li_entry.title) + "...");
+
+	// the daemon gives it an ID
+	if (sv_remote && sv_apply({ li_record(LI_J_ADD, li_entry) })) return;
+
+	// the list it goes to has to be loaded first
+	li_shard_need(li_entry.tag);
+
+	noaftodo_entry new_entry = li_entry;
+	if ((new_entry.id == 0) || (li_index.count(new_entry.id) != 0))
+		li_assign_id(new_entry, false);
+
+	li_do_add(new_entry);
+
+	li_notify(LI_J_ADD, new_entry);
+
+	li_commit(li_record(LI_J_ADD, new_entry));
+}
+
+void li_add(const vector<noaftodo_entry>& entries)
+{
+	if (entries.empty()) return;
+
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	log("Adding " + to_string(entries.size()) + " tasks...");
+
+	if (sv_remote)
+	{
+		vector<string> records;
+		records.reserve(entries.size());
+		for (const auto& li_entry : entries)
+			records.push_back(li_record(LI_J_ADD, li_entry));
+
+		li_bulk_begin();
+		const bool sent = sv_apply(records);
+		li_bulk_end();
+
+		if (sent) return;
+	}
+
+	// the entries are appended and sorted in once, the list is saved
+	// and the daemon is notified once - in the end of the bulk edit
+	li_bulk_begin();
+
+	for (const auto& li_entry : entries)
+	{
+		li_shard_need(li_entry.tag);
+
+		noaftodo_entry new_entry = li_entry;
+		if ((new_entry.id == 0) || (li_index.count(new_entry.id) != 0))
+			li_assign_id(new_entry, false);
+
+		li_do_add(new_entry);
+	}
+
+	// one snapshot instead of a journal record per entry
+	li_commit("");
+	li_notify(LI_J_ADD, entries.front());
+
+	li_bulk_end();
+}
+
+void li_comp(const uint64_t& id)
+{
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	const int entryID = li_find(id);
+	if (sv_remote && (entryID != -1) && sv_apply({ li_record(LI_J_COMP, { !t_list.at(entryID).completed, 0, "", "", 0, id }) })) return;
+
+	if (entryID == -1)
+	{
+		log("li_comp: no entry with ID " + to_string(id) + ". Operation aborted", LP_ERROR);
+		return;
+	}
+
+	const bool completed = !t_list.at(entryID).completed;
+	li_do_comp(entryID, completed);
+
+	li_notify(LI_J_COMP, t_list.at(entryID));
+
+	li_commit(li_record(LI_J_COMP, t_list.at(entryID)));
+}
+
+void li_rem(const uint64_t& id)
+{
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	if (sv_remote && (li_find(id) != -1) && sv_apply({ li_record(LI_J_REM, { false, 0, "", "", 0, id }) })) return;
+
+	const int entryID = li_find(id);
+	if (entryID == -1)
+	{
+		log("li_rem: no entry with ID " + to_string(id) + ". Operation aborted", LP_ERROR);
+		return;
+	}
+
+	log("Removing " + string(t_list.at(entryID).title) + "...");
+	const noaftodo_entry removed = t_list.at(entryID);
+	li_do_rem(entryID);
+
+	li_notify(LI_J_REM, { removed.completed, removed.due, "", "", removed.tag, removed.id });
+
+	li_commit(li_record(LI_J_REM, removed));
+}
+
+void li_mv(const uint64_t& id, const int& tag)
+{
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	if (tag < 0)
+	{
+		log("li_mv: negative tag. Operation aborted", LP_ERROR);
+		return;
+	}
+
+	if (sv_remote && (li_find(id) != -1) && sv_apply({ li_record(LI_J_MOVE, { false, 0, "", "", tag, id }) })) return;
+
+	// the list it goes to has to be loaded first
+	li_shard_need(tag);
+
+	const int entryID = li_find(id);
+	if (entryID == -1)
+	{
+		log("li_mv: no entry with ID " + to_string(id) + ". Operation aborted", LP_ERROR);
+		return;
+	}
+
+	li_do_mv(entryID, tag);
+
+	li_notify(LI_J_MOVE, { false, 0, "", "", tag, id });
+
+	li_commit(li_record(LI_J_MOVE, t_list.at(entryID)));
+}
+
+void li_tag_rename(const int& tag, const string& name)
+{
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	if (tag < 0)
+	{
+		log("li_tag_rename: negative tag. Operation aborted", LP_ERROR);
+		return;
+	}
+
+	if (sv_remote && sv_apply({ li_record(LI_J_RENAME, { false, 0, name, "", tag, 0 }) })) return;
+
+	li_do_rename(tag, name);
+
+	li_notify(LI_J_RENAME, { false, 0, name, "", tag, 0 });
+
+	li_commit(li_record(LI_J_RENAME, { false, 0, name, "", tag, 0 }));
+}
+
+int li_find(const uint64_t& id)
+{
+	const auto it = li_index.find(id);
+	return (it == li_index.end()) ? -1 : it->second;
+}
+
+string_view li_intern(string_view str)
+{
+	if (str.empty()) return "";
+
+	auto& strings = li_pool->strings;
+
+	// keep the table at most half full
+	if (li_pool->count * 2 >= strings.size())
+	{
+		vector<string_view> old_strings(max<size_t>(1024, strings.size() * 2));
+		old_strings.swap(strings);
+
+		for (const auto& old_str : old_strings)
+			if (old_str.data() != nullptr)
+			{
+				size_t slot = hash<string_view>()(old_str) & (strings.size() - 1);
+				while (strings[slot].data() != nullptr) slot = (slot + 1) & (strings.size() - 1);
+				strings[slot] = old_str;
+			}
+	}
+
+	size_t slot = hash<string_view>()(str) & (strings.size() - 1);
+	for ( ; strings[slot].data() != nullptr; slot = (slot + 1) & (strings.size() - 1))
+		if (strings[slot] == str) return strings[slot];
+
+	strings[slot] = string_view(li_pool_copy(*li_pool, str.data(), str.length()), str.length());
+	li_pool->count++;
+
+	return strings[slot];
+}
+
+string_view li_description(const noaftodo_entry& li_entry)
+{
+	return li_description(li_entry, *li_pool);
+}
+
+string_view li_description(const noaftodo_entry& li_entry, li_pool_s& pool)
+{
+	if (li_entry.desc_offset < 0) return li_entry.description;
+
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	const auto cached = pool.descriptions.find(li_entry.desc_offset);
+	if (cached != pool.descriptions.end()) return cached->second;
+
+	const string description = li_desc_read(pool, li_entry);
+	return pool.descriptions[li_entry.desc_offset] = string_view(li_pool_copy(pool, description.data(), description.length()), description.length());
+}
+
+string li_entry_str(const noaftodo_entry& li_entry)
+{
+	return li_entry_line(li_entry, li_description(li_entry));
+}
+
+string li_record(const char& op, const noaftodo_entry& li_entry)
+{
+	switch (op)
+	{
+		case LI_J_ADD:
+			return string(1, op) + '\\' + li_entry_str(li_entry);
+		case LI_J_COMP:
+			return string(1, op) + '\\' + to_string(li_entry.id) + '\\' + (li_entry.completed ? "v" : "-") + '\\';
+		case LI_J_REM:
+			return string(1, op) + '\\' + to_string(li_entry.id) + '\\';
+		case LI_J_MOVE:
+			return string(1, op) + '\\' + to_string(li_entry.id) + '\\' + to_string(li_entry.tag) + '\\';
+		case LI_J_RENAME:
+			return string(1, op) + '\\' + to_string(li_entry.tag) + '\\' + string(li_entry.title);
+	}
+
+	return "";
+}
+
+// a journal record as a change: its type and the fields it has.
+// Strings point into the record
+static bool li_parse_record(const string& record, char& op, noaftodo_entry& li_entry)
+{
+	if (record.length() < 2) return false;
+
+	op = record.at(0);
+	const string_view body = string_view(record).substr(2);
+	li_entry = { false, 0, "", "", -1, 0 };
+
+	if (op == LI_J_ADD)
+	{
+		li_entry = li_parse_entry(body);
+		return true;
+	}
+
+	const size_t sep = body.find('\\');
+	if (sep == string_view::npos) return false;
+
+	if (op == LI_J_RENAME)
+	{
+		from_chars(body.data(), body.data() + sep, li_entry.tag);
+		li_entry.title = body.substr(sep + 1);
+		return true;
+	}
+
+	from_chars(body.data(), body.data() + sep, li_entry.id);
+
+	const string_view field = body.substr(sep + 1, body.find('\\', sep + 1) - sep - 1);
+	switch (op)
+	{
+		case LI_J_COMP:
+			li_entry.completed = (field == "v");
+			return true;
+		case LI_J_REM:
+			return true;
+		case LI_J_MOVE:
+			return from_chars(field.data(), field.data() + field.length(), li_entry.tag).ec == errc();
+	}
+
+	return false;
+}
+
+noaftodo_entry li_parse_entry(string_view str)
+{
+	noaftodo_entry li_entry = { false, 0, "", "", 0, 0 };
+
+	// text after the last backslash is not a field
+	for (int token = 0; ; token++)
+	{
+		const char* sep = (const char*)memchr(str.data(), '\\', str.length());
+		if (sep == nullptr) break;
+
+		const string_view temp(str.data(), sep - str.data());
+		str.remove_prefix(temp.length() + 1);
+
+		switch (token)
+		{
+			case 0:
+				li_entry.completed = (temp == "v");
+				break;
+			case 1:
+				from_chars(temp.data(), temp.data() + temp.length(), li_entry.due);
+				break;
+			case 2:
+				li_entry.title = temp;
+				break;
+			case 3:
+				li_entry.description = temp;
+				break;
+			case 4:
+				from_chars(temp.data(), temp.data() + temp.length(), li_entry.tag);
+				break;
+			case 5:
+				from_chars(temp.data(), temp.data() + temp.length(), li_entry.id);
+				break;
+		}
+	}
+
+	return li_entry;
+}
+
+bool li_apply(const char& op, const noaftodo_entry& li_entry)
+{
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	// the one who made the change saves it
+	const bool modified = li_modified;
+
+	if ((op == LI_J_ADD) || (op == LI_J_MOVE)) li_shard_need(li_entry.tag);
+
+	const int entryID = li_find(li_entry.id);
+	if ((op == LI_J_ADD) ? ((li_entry.id == 0) || (entryID != -1)) : ((op != LI_J_RENAME) && (entryID == -1))) return false;
+
+	switch (op)
+	{
+		case LI_J_ADD:
+			li_do_add(li_entry);
+			break;
+		case LI_J_COMP:
+			li_do_comp(entryID, li_entry.completed);
+			break;
+		case LI_J_REM:
+			li_do_rem(entryID);
+			break;
+		case LI_J_MOVE:
+			if (li_entry.tag < 0) return false;
+			li_do_mv(entryID, li_entry.tag);
+			break;
+		case LI_J_RENAME:
+			if (li_entry.tag < 0) return false;
+			li_do_rename(li_entry.tag, string(li_entry.title));
+			break;
+		default:
+			return false;
+	}
+
+	li_modified = modified;
+
+	return true;
+}
+
+bool li_apply_record(const string& record)
+{
+	char op;
+	noaftodo_entry li_entry;
+
+	return li_parse_record(record, op, li_entry) && li_apply(op, li_entry);
+}
+
+bool li_exec_record(const string& record)
+{
+	char op;
+	noaftodo_entry li_entry;
+	if (!li_parse_record(record, op, li_entry)) return false;
+
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	if (op == LI_J_ADD)
+	{
+		li_add(li_entry);
+		return true;
+	}
+
+	if (op == LI_J_RENAME)
+	{
+		if (li_entry.tag < 0) return false;
+
+		li_tag_rename(li_entry.tag, string(li_entry.title));
+		return true;
+	}
+
+	const int entryID = li_find(li_entry.id);
+	if (entryID == -1) return false;
+
+	switch (op)
+	{
+		case LI_J_COMP:
+			// the record says what it should be, li_comp() toggles
+			if (t_list.at(entryID).completed != li_entry.completed) li_comp(li_entry.id);
+			return true;
+		case LI_J_REM:
+			li_rem(li_entry.id);
+			return true;
+		case LI_J_MOVE:
+			if (li_entry.tag < 0) return false;
+
+			li_mv(li_entry.id, li_entry.tag);
+			return true;
+	}
+
+	return false;
+}
+
+void li_saved(const string& filename, const li_file_id_s& file)
+{
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	if (li_loaded_of != li_filename) return;
+
+	const string path = li_abs_filename(filename);
+
+	// it's announced before it's renamed in place
+	const li_file_id_s current = li_file_id(path);
+	if (current == file) li_replaced.erase(path);
+	else li_replaced[path] = current;
+
+	if (path == li_abs_filename(li_filename)) li_loaded_file = file;
+	else if (path == li_abs_filename(li_filename + LI_JOURNAL_SUFFIX)) li_loaded_journal = file;
+	else for (int tag = 0; li_sharded && (tag < (int)li_shards.size()); tag++)
+		if (path == li_abs_filename(li_shard_filename(tag)))
+		{
+			li_shards.at(tag).exists = (file.size >= 0);
+			li_shards.at(tag).file = file;
+		}
+}
+
+void li_journal_replay()
+{
+	const string j_filename = li_filename + LI_JOURNAL_SUFFIX;
+
+	ifstream jfile(j_filename);
+	if (!jfile.good()) return;
+
+	// the last line of a journal can be a record a crash cut short:
+	// only lines that end with a line break are whole
+	string record;
+	if (!getline(jfile, record) || jfile.eof()) return;
+
+	if (record != "# generation " + to_string(li_generation))
+	{
+		log("Journal " + j_filename + " does not match list generation " + to_string(li_generation) + ". Ignored", LP_ERROR);
+		return;
+	}
+
+	int count = 0;
+	while (getline(jfile, record))
+	{
+		if (jfile.eof())
+		{
+			log("Journal record " + record + " is cut short. Ignored", LP_ERROR);
+			break;
+		}
+
+		char op;
+		noaftodo_entry li_entry;
+		if (!li_parse_record(record, op, li_entry)) continue;
+
+		int entryID = -1;
+
+		if ((op != LI_J_ADD) && (op != LI_J_RENAME))
+		{
+			entryID = li_find(li_entry.id);
+			if (entryID == -1)
+			{
+				log("Journal entry " + record + " does not match any task", LP_ERROR);
+				continue;
+			}
+		}
+
+		switch (op)
+		{
+			case LI_J_ADD:
+				if ((li_entry.id == 0) || (li_index.count(li_entry.id) != 0))
+					li_assign_id(li_entry, true);
+
+				li_do_add(li_entry);
+				break;
+			case LI_J_COMP:
+				li_do_comp(entryID, li_entry.completed);
+				break;
+			case LI_J_REM:
+				li_do_rem(entryID);
+				break;
+			case LI_J_MOVE:
+				li_do_mv(entryID, li_entry.tag);
+				break;
+			case LI_J_RENAME:
+				if (li_entry.tag >= 0) li_do_rename(li_entry.tag, string(li_entry.title));
+				break;
+		}
+
+		count++;
+	}
+
+	log("Replayed " + to_string(count) + " journal records");
+}
+
+void li_sort()
+{
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	// lists saved by us are already sorted. Entries appended after
+	// the sorted part are sorted on their own and merged in
+	const auto sorted_end = is_sorted_until(t_list.begin(), t_list.end(), less_than_noaftodo_entry());
+	if (sorted_end != t_list.end())
+	{
+		stable_sort(sorted_end, t_list.end(), less_than_noaftodo_entry());
+		inplace_merge(t_list.begin(), sorted_end, t_list.end(), less_than_noaftodo_entry());
+	}
+
+	li_sorted = true;
+	li_reindex(0);
+
+	li_cols.completed.resize(t_list.size());
+	li_cols.due.resize(t_list.size());
+	li_cols.tag.resize(t_list.size());
+	for (int i = 0; i < (int)t_list.size(); i++)
+	{
+		const auto& entry = t_list.at(i);
+		li_cols.completed[i] = entry.completed;
+		li_cols.due[i] = entry.due;
+		li_cols.tag[i] = entry.tag;
+	}
+
+	li_classify(li_time.now, li_time.coming, li_cols.state);
+}
+
+void li_classify(const long& failed_due, const long& coming_due, vector<uint8_t>& states)
+{
+	const size_t size = li_cols.due.size();
+	states.resize(size);
+
+	const uint8_t* completed = li_cols.completed.data();
+	const long* due = li_cols.due.data();
+	uint8_t* state = states.data();
+
+	// local copies: the output is bytes and might alias the references
+	const long failed_t = failed_due;
+	const long coming_t = coming_due;
+
+	// one pass with no branches over the columns: the states of a list
+	// that's due in no particular order cost no mispredictions.
+	// due <= t is taken from the sign bit of (due - t - 1), which also
+	// leaves the loop open to vectorization where the build asks for it
+	for (size_t i = 0; i < size; i++)
+	{
+		const uint8_t failed = (uint64_t)(due[i] - failed_t - 1) >> 63;
+		const uint8_t coming = (uint64_t)(due[i] - coming_t - 1) >> 63;
+		const uint8_t done = (completed[i] != 0);
+
+		state[i] = done * LI_S_COMPLETE +
+			(1 - done) * (failed * LI_S_FAILED + (coming - failed) * LI_S_COMING + (1 - coming) * LI_S_UNCAT);
+	}
+}
+
+uint8_t li_state(const int& entryID, const long& failed_due, const long& coming_due)
+{
+	if (li_cols.completed.at(entryID)) return LI_S_COMPLETE;
+	if (li_cols.due.at(entryID) <= failed_due) return LI_S_FAILED;
+	if (li_cols.due.at(entryID) <= coming_due) return LI_S_COMING;
+
+	return LI_S_UNCAT;
+}
+
+void li_update_states(const ti_snapshot_s& t)
+{
+	lock_guard<recursive_mutex> list_lock(li_mutex);
+
+	// the clock went back, or entries were appended unsorted
+	if (!li_sorted || (t.now < li_time.now) || (t.coming < li_time.coming) || (li_cols.state.size() != li_cols.due.size()))
+	{
+		li_classify(t.now, t.coming, li_cols.state);
+		li_time = t;
+		return;
+	}
+
+	// entries due in (from, to]
+	const auto update = [&t](const long& from, const long& to)
+	{
+		const auto begin = upper_bound(li_cols.due.begin(), li_cols.due.end(), from);
+		const auto end = upper_bound(begin, li_cols.due.end(), to);
+
+		for (auto it = begin; it != end; it++)
+		{
+			const int entryID = it - li_cols.due.begin();
+			li_cols.state[entryID] = li_state(entryID, t.now, t.coming);
+		}
+	};
+
+	update(li_time.now, t.now);
+	update(li_time.coming, t.coming);
+
+	li_time = t;
+}
+
+void li_bulk_begin()
+{
+	if ((li_bulk == 0) && sv_remote) sv_bulk(true);
+	li_bulk++;
+}
+
+void li_bulk_end()
+{
+	if (li_bulk == 0) return;
+	li_bulk--;
+	if (li_bulk > 0) return;
+
+	// the daemon made the changes
+	if (sv_remote && sv_bulk(false)) return;
+
+	if (!li_sorted) li_sort();
+
+	if (li_unsaved)
+	{
+		li_unsaved = false;
+		li_write_request("");
+	}
+
+	if (li_pending_reload)
+	{
+		li_pending_reload = false;
+
+		da_message_s message;
+		message.op = DA_OP_RELOAD;
+		da_send(message);
+	}
 }
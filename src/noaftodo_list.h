@@ -1,18 +1,90 @@
 #ifndef NOAFTODO_LIST_H
 #define NOAFTODO_LIST_H
 
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+#include "noaftodo_time.h"
+
 struct noaftodo_entry
 {
 	bool completed;
 	long due;
-	std::string title;
-	std::string description;
+	std::string_view title;		// views into li_pool, see li_intern()
+	std::string_view description;
 	int tag;
+	uint64_t id;	// persistent entry ID, 0 - not assigned yet
 
-	bool sim(const noaftodo_entry& e2);
+	// description left in the list file, see li_description().
+	// -1 - the description is in memory
+	int64_t desc_offset = -1;
+	uint32_t desc_length = 0;
+};
+
+// string storage of one loaded list generation. Strings are copied into
+// big blocks and equal strings are stored once
+struct li_pool_s
+{
+	std::vector<std::unique_ptr<char[]>> blocks;
+	char* next = nullptr;		// free space in the last block
+	size_t free = 0;
+
+	// interned strings - open addressing hash table, size is a power of 2
+	std::vector<std::string_view> strings;
+	size_t count = 0;
+
+	// the list file descriptions are left in. It stays open, so they can
+	// be read even after the file is replaced by a newer generation
+	int fd = -1;
+	std::unordered_map<int64_t, std::string_view> descriptions;	// offset -> description read so far
+
+	// pools of the lists of the sharded layout, kept alive with this one
+	std::vector<std::shared_ptr<li_pool_s>> shards;
+
+	~li_pool_s();
+};
+
+// fields of t_list the filters look at, stored column by column, so that
+// scanning them does not pull titles and descriptions into cache.
+// li_cols.X[i] is always t_list[i].X
+struct li_columns_s
+{
+	std::vector<uint8_t> completed;
+	std::vector<long> due;
+	std::vector<int> tag;
+
+	std::vector<uint8_t> state;	// task state at li_time
+};
+
+// a version of a file on disk. Any write makes a new one:
+// ours replace the file (new inode), others change size or mtime
+struct li_file_id_s
+{
+	uint64_t ino = 0;
+	int64_t size = -1;	// -1 - no file
+	int64_t mtime = 0;	// ns
+
+	inline bool operator== (const li_file_id_s& other) const
+	{
+		return (ino == other.ino) && (size == other.size) && (mtime == other.mtime);
+	}
+};
+
+// one tag of the sharded layout, stored in <list file>.<tag>
+struct li_shard_s
+{
+	bool exists = false;	// has a file
+	bool loaded = false;	// its entries are in t_list
+	bool dirty = false;	// has changes that are not written yet
+
+	li_file_id_s file;	// as it was loaded
+
+	std::shared_ptr<li_pool_s> pool;	// strings of its entries
 };
 
 struct less_than_noaftodo_entry
@@ -23,21 +95,164 @@ struct less_than_noaftodo_entry
 	}
 };
 
-extern std::vector<noaftodo_entry> t_list;	// the list itself
-extern std::vector<std::string> t_tags;		// list tags
-extern std::string li_filename;		// the list filename
-extern bool li_autosave;
+// task states. Values match the CUI filter bits
+constexpr uint8_t LI_S_UNCAT = 0b1;
+constexpr uint8_t LI_S_COMPLETE = 0b10;
+constexpr uint8_t LI_S_COMING = 0b100;
+constexpr uint8_t LI_S_FAILED = 0b1000;
+
+// string pool block size
+constexpr size_t LI_POOL_BLOCK = 64 * 1024;
+
+// list file formats
+constexpr int LI_FORMAT_TEXT = 0;
+constexpr int LI_FORMAT_BINARY = 1;
 
-void li_load();
-void li_load(const std::string& filename);
+// binary list file magic and version
+constexpr char LI_BIN_MAGIC[8] = { 'N', 'O', 'A', 'F', 'L', 'I', 'S', 'T' };
+constexpr int LI_BIN_VERSION = 2;
 
-void li_save();
+// journal file is stored next to the list file
+constexpr char LI_JOURNAL_SUFFIX[] = ".journal";
+constexpr char LI_DAMAGED_SUFFIX[] = ".damaged";	// a list file that could not be read is moved there
+
+// journal record types
+constexpr char LI_J_ADD = 'a';
+constexpr char LI_J_COMP = 'c';
+constexpr char LI_J_REM = 'r';
+constexpr char LI_J_MOVE = 'm';
+constexpr char LI_J_RENAME = 'n';
+
+// everything li_ keeps about a list. The globals below are the fields of
+// the one in use. The daemon keeps one for every list it serves and swaps
+// it with the one in use to work with it, see li_swap()
+struct li_context_s
+{
+	std::vector<noaftodo_entry> list;
+	std::vector<std::string> tags;
+	std::unordered_map<uint64_t, int> index;
+	li_columns_s cols;
+	ti_snapshot_s time;
+	std::shared_ptr<li_pool_s> pool = std::make_shared<li_pool_s>();
+	std::string filename = ".noaftodo-list";
+	bool autosave = true;
+	long generation = 0;
+	uint32_t changes = 0;
+	int format = LI_FORMAT_TEXT;
+	int bulk = 0;
+	bool sorted = true;
+	bool exec_workspace = true;
+	bool sharded = false;
+	std::vector<li_shard_s> shards;
+
+	// what li_load() has loaded
+	bool unsaved = false;
+	bool modified = false;
+	bool pending_reload = false;
+	std::string loaded_of;
+	li_file_id_s loaded_file;
+	li_file_id_s loaded_journal;
+	std::unordered_map<std::string, li_file_id_s> replaced;
+};
+
+extern std::vector<noaftodo_entry>& t_list;	// the list itself
+extern std::vector<std::string>& t_tags;		// list tags
+extern std::unordered_map<uint64_t, int>& li_index;	// entry ID -> position in t_list
+extern li_columns_s& li_cols;
+extern ti_snapshot_s& li_time;		// the time li_cols.state is for, see li_update_states()
+extern std::shared_ptr<li_pool_s>& li_pool;	// strings of t_list. Replaced by li_load()
+extern std::string& li_filename;		// the list filename
+extern bool& li_autosave;			// hand changes to the background writer
+extern long& li_generation;		// snapshot generation, bumped on every li_save()
+extern uint32_t& li_changes;		// changes on top of generation li_generation t_list has
+extern int& li_format;			// format li_save() writes. Set by li_load()
+extern int& li_bulk;			// >0 while a bulk edit is in progress
+extern bool& li_sorted;			// false if entries were appended during a bulk edit
+extern bool& li_exec_workspace;		// run [workspace] commands on load. The daemon does not
+extern bool& li_sharded;			// each tag is stored in its own file, see li_layout()
+extern std::vector<li_shard_s>& li_shards;	// tag -> its file
+
+// false if nothing changed on disk since the last load, and nothing was read
+bool li_load();
+bool li_load(const std::string& filename);
+void li_load_text(const std::string& contents);	// the list as the daemon sent it, see li_dump()
+
+// the whole list in the text format, and the generation and changes it has
+std::string li_dump(long& generation, uint32_t& changes);
+
+void li_save();				// write the list now
 void li_save(const std::string& filename);
+void li_flush();			// wait for the autosave writer to write everything it has
+void li_convert(const int& format);	// write the list in another format, see LI_FORMAT_X
+
+// put another list in place of the one in use. The one in use goes to the context
+void li_swap(li_context_s& context);
+
+// replace the file with new contents: write a temporary file next to it,
+// sync it, rename it over the original and sync the directory.
+// before_rename is handed the file as it's going to be. Mode - of a new file
+bool li_write_atomic(const std::string& filename, const std::string& contents,
+		const std::function<void(const li_file_id_s&)>& before_rename = {}, const int& mode = 0644);
+
+// absolute path of a file, as both the daemon and the client name it
+std::string li_abs_filename(const std::string& filename);
+
+// sharded layout: a manifest in the list file and a file per tag.
+// Lists are loaded the first time they are needed and only the ones
+// that changed are written
+void li_layout(const bool& sharded);
+void li_shard_need(const int& tag);	// load the list of the tag, -1 - all lists
+std::string li_shard_filename(const int& tag);
 
 void li_add(const noaftodo_entry& li_entry);
-void li_comp(const int& entryID);
-void li_rem(const int& entryID);
+void li_add(const std::vector<noaftodo_entry>& entries);	// add many at once, see li_bulk_begin()
+void li_comp(const uint64_t& id);
+void li_rem(const uint64_t& id);
+void li_mv(const uint64_t& id, const int& tag);
+void li_tag_rename(const int& tag, const std::string& name);
+
+int li_find(const uint64_t& id);	// position of the entry with given ID, -1 if there's none
+
+std::string_view li_intern(std::string_view str);	// copy the string into li_pool, once
+
+// entry description, read from the list file if it was left there.
+// Entries of older generations (e.g. the daemon cache) need their own pool
+std::string_view li_description(const noaftodo_entry& li_entry);
+std::string_view li_description(const noaftodo_entry& li_entry, li_pool_s& pool);
+
+std::string li_entry_str(const noaftodo_entry& li_entry);
+std::string li_record(const char& op, const noaftodo_entry& li_entry);	// journal record of a change
+noaftodo_entry li_parse_entry(std::string_view str);
+
+void li_journal_replay();
+
+// a change made by another process, as the daemon was told about it:
+// op is a journal record type. The list is not saved and nobody is notified.
+// False if the change does not fit the list
+bool li_apply(const char& op, const noaftodo_entry& li_entry);
+bool li_apply_record(const std::string& record);
+
+// make the change a journal record tells about, as if it was made here:
+// it's saved and the daemon clients are told about it. False if it does not fit the list
+bool li_exec_record(const std::string& record);
+
+// another process wrote the file, and t_list has everything the file has:
+// li_load() won't read it again as long as it stays that way
+void li_saved(const std::string& filename, const li_file_id_s& file);
 
 void li_sort();
 
+// task states against the given times: due <= failed_due - failed, due <= coming_due - coming
+void li_classify(const long& failed_due, const long& coming_due, std::vector<uint8_t>& states);
+uint8_t li_state(const int& entryID, const long& failed_due, const long& coming_due);
+
+// bring li_cols.state to the time t. The list is sorted by due, so only
+// the entries due between the old and the new times are looked at
+void li_update_states(const ti_snapshot_s& t);
+
+// bulk edits: li_add() appends without keeping the list ordered,
+// the list is sorted, saved and the daemon is notified once in li_bulk_end()
+void li_bulk_begin();
+void li_bulk_end();
+
 #endif
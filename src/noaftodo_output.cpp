@@ -14,10 +14,29 @@ void log(const string& message, const char& prefix)
 string format_str(const string& str, const noaftodo_entry& li_entry, const bool& renotify)
 {
 	string ret = str;
-	int index = -1;
+	size_t index;
 	while ((index = ret.find("%T%")) != string::npos) ret.replace(index, 3, li_entry.title);
-	while ((index = ret.find("%D%")) != string::npos) ret.replace(index, 3, li_entry.description);
+	while ((index = ret.find("%D%")) != string::npos) ret.replace(index, 3, li_description(li_entry));
 	while ((index = ret.find("%VER%")) != string::npos) ret.replace(index, 5, VERSION);
 	while ((index = ret.find("%N%")) != string::npos) ret.replace(index, 3, renotify ? "false" : "true");
+	while ((index = ret.find("%COUNT%")) != string::npos) ret.replace(index, 7, "1");
+	while ((index = ret.find("%TITLES%")) != string::npos) ret.replace(index, 8, li_entry.title);
 	return ret;
 }
+
+string format_str(const string& str, const vector<noaftodo_entry>& entries, const bool& renotify)
+{
+	if (entries.empty()) return format_str(str, noaftodo_entry {}, renotify);
+
+	string titles = "";
+	for (int i = 0; (i < (int)entries.size()) && (i < FORMAT_BATCH_TITLES); i++)
+		titles += ((i == 0) ? "" : ", ") + string(entries.at(i).title);
+	if (entries.size() > FORMAT_BATCH_TITLES) titles += " and " + to_string(entries.size() - FORMAT_BATCH_TITLES) + " more";
+
+	string ret = str;
+	size_t index;
+	while ((index = ret.find("%COUNT%")) != string::npos) ret.replace(index, 7, to_string(entries.size()));
+	while ((index = ret.find("%TITLES%")) != string::npos) ret.replace(index, 8, titles);
+
+	return format_str(ret, entries.front(), renotify);
+}
@@ -2,6 +2,7 @@
 #define NOAFTODO_OUTPUT_H
 
 #include <string>
+#include <vector>
 
 #include "noaftodo_list.h"
 
@@ -9,8 +10,15 @@
 constexpr char LP_DEFAULT = 'i';
 constexpr char LP_ERROR = '!';
 
+// %TITLES% of a batch lists at most that many titles
+constexpr int FORMAT_BATCH_TITLES = 10;
+
 void log(const std::string& message, const char& prefix = LP_DEFAULT);
 
 std::string format_str(const std::string& str, const noaftodo_entry& li_entry, const bool& renotify = false);
 
+// a batch of tasks: %COUNT% - how many there are, %TITLES% - their titles.
+// Other placeholders are filled from the first one
+std::string format_str(const std::string& str, const std::vector<noaftodo_entry>& entries, const bool& renotify = false);
+
 #endif
@@ -0,0 +1,567 @@
+#include "noaftodo_server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "noaftodo_cmd.h"
+#include "noaftodo_cui.h"
+#include "noaftodo_list.h"
+#include "noaftodo_output.h"
+
+using namespace std;
+
+// the list served now. sv_swap() puts another one in its place
+static sv_context_s sv_ctx;
+
+static int& sv_listen_fd = sv_ctx.listen_fd;
+static vector<sv_client_s>& sv_clients = sv_ctx.clients;
+
+static deque<sv_change_s>& sv_changes = sv_ctx.changes;
+static long& sv_base_generation = sv_ctx.base_generation;	// where the list was before the first of sv_changes
+static uint32_t& sv_base_changes = sv_ctx.base_changes;
+
+bool sv_remote = false;
+static int sv_fd = -1;		// connection to the daemon
+static string sv_in;		// read, not handled yet
+
+static void sv_nonblock(const int& fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+static sockaddr_un sv_address()
+{
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, da_name(SV_SOCKET_FILE).c_str(), sizeof(addr.sun_path) - 1);
+
+	return addr;
+}
+
+static string sv_snapshot()
+{
+	long generation;
+	uint32_t changes;
+	const string contents = li_dump(generation, changes);
+
+	return string(1, SV_F_SNAPSHOT) + ' ' + to_string(generation) + ' ' + to_string(changes) + ' ' + to_string(contents.length()) + '\n' + contents;
+}
+
+void sv_swap(sv_context_s& context)
+{
+	swap(sv_ctx, context);
+}
+
+bool sv_open()
+{
+	// the lock file says no other daemon runs: the socket is left from one that's gone
+	unlink(da_name(SV_SOCKET_FILE).c_str());
+
+	sv_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sv_listen_fd == -1) return false;
+	sv_nonblock(sv_listen_fd);
+
+	// only the user can connect
+	const sockaddr_un addr = sv_address();
+	const mode_t mask = umask(S_IRWXG | S_IRWXO);
+	const bool bound = (bind(sv_listen_fd, (const sockaddr*)&addr, sizeof(addr)) == 0);
+	umask(mask);
+
+	if (!bound || (listen(sv_listen_fd, SOMAXCONN) == -1))
+	{
+		close(sv_listen_fd);
+		sv_listen_fd = -1;
+		return false;
+	}
+
+	sv_changes.clear();
+	sv_base_generation = li_generation;
+	sv_base_changes = li_changes;
+
+	return true;
+}
+
+// the client is gone: the bulk edits it left open are ended
+static void sv_drop(sv_client_s& client)
+{
+	for (; client.bulk > 0; client.bulk--) li_bulk_end();
+
+	close(client.fd);
+}
+
+void sv_close()
+{
+	if (sv_listen_fd == -1) return;
+
+	for (auto& client : sv_clients) sv_drop(client);
+	sv_clients.clear();
+
+	close(sv_listen_fd);
+	sv_listen_fd = -1;
+	unlink(da_name(SV_SOCKET_FILE).c_str());
+}
+
+void sv_fds(vector<pollfd>& fds)
+{
+	if (sv_listen_fd == -1) return;
+
+	fds.push_back({ sv_listen_fd, POLLIN, 0 });
+	for (const auto& client : sv_clients)
+		fds.push_back({ client.fd, (short)(POLLIN | (client.out.empty() ? 0 : POLLOUT)), 0 });
+}
+
+static void sv_send_all(const string& line)
+{
+	for (auto& client : sv_clients)
+		if (client.subscribed) client.out += line;
+}
+
+void sv_feed(const da_message_s& message)
+{
+	if (sv_listen_fd == -1) return;
+
+	string record;
+	if (message.op == DA_OP_RELOAD) record = "";
+	else if (!message.truncated) record = li_record(message.op, da_entry(message));
+	else if (message.op == LI_J_ADD)
+	{	// the strings did not fit the message, but the task was just added
+		const int entryID = li_find(message.id);
+		if (entryID != -1) record = li_record(message.op, t_list.at(entryID));
+	}
+
+	// a change that can't be told as a record - everyone gets the whole list
+	if (record.empty())
+	{
+		const string snapshot = sv_snapshot();
+		sv_changes.clear();
+		sscanf(snapshot.c_str() + 2, "%ld %u", &sv_base_generation, &sv_base_changes);
+
+		sv_send_all(snapshot);
+		return;
+	}
+
+	const string line = string(1, SV_F_CHANGE) + ' ' + to_string(message.generation) + ' ' + to_string(message.changes) + ' ' + record + '\n';
+
+	sv_changes.push_back({ message.generation, message.changes, line });
+	if (sv_changes.size() > SV_FEED_KEEP)
+	{
+		sv_base_generation = sv_changes.front().generation;
+		sv_base_changes = sv_changes.front().changes;
+		sv_changes.pop_front();
+	}
+
+	sv_send_all(line);
+}
+
+static void sv_reply(sv_client_s& client, const int& code, string text)
+{
+	replace(text.begin(), text.end(), '\n', ' ');
+	client.out += string(1, SV_F_REPLY) + ' ' + to_string(code) + ' ' + text + '\n';
+}
+
+// "f [<generation> <changes>]": the changes the client missed, or the whole list
+static void sv_subscribe(sv_client_s& client, const string& position)
+{
+	long generation;
+	uint32_t changes;
+	bool found = (sscanf(position.c_str(), "%ld %u", &generation, &changes) == 2);
+
+	auto from = sv_changes.begin();
+	if (found && ((generation != sv_base_generation) || (changes != sv_base_changes)))
+	{
+		from = find_if(sv_changes.begin(), sv_changes.end(), [&generation, &changes](const sv_change_s& change)
+			{ return (change.generation == generation) && (change.changes == changes); });
+
+		found = (from != sv_changes.end());
+		if (found) from++;
+	}
+
+	if (found)
+		for (; from != sv_changes.end(); from++) client.out += from->line;
+	else client.out += sv_snapshot();
+
+	client.subscribed = true;
+}
+
+static void sv_run(sv_client_s& client, const string& request)
+{
+	const char type = request.empty() ? 0 : request.at(0);
+	const string arg = (request.length() > 2) ? request.substr(2) : "";
+
+	switch (type)
+	{
+		case SV_R_EXEC:
+		{
+			// every client has its own selection
+			cui_status = "";
+			cui_s_line = client.s_line;
+			cui_s_id = client.s_id;
+			cui_sync_selection();
+
+			const int code = cmd_exec(arg);
+
+			client.s_line = cui_s_line;
+			client.s_id = cui_s_id;
+			sv_reply(client, code, cui_status);
+			break;
+		}
+		case SV_R_RECORD:
+			sv_reply(client, li_exec_record(arg) ? 0 : 1, "");
+			break;
+		case SV_R_BULK_BEGIN:
+			li_bulk_begin();
+			client.bulk++;
+			sv_reply(client, 0, "");
+			break;
+		case SV_R_BULK_END:
+			if (client.bulk > 0)
+			{
+				client.bulk--;
+				li_bulk_end();
+			}
+			sv_reply(client, 0, "");
+			break;
+		case SV_R_FEED:
+			sv_subscribe(client, arg);
+			sv_reply(client, 0, "");
+			break;
+		default:
+			sv_reply(client, 1, "Unknown request");
+	}
+}
+
+void sv_serve()
+{
+	if (sv_listen_fd == -1) return;
+
+	int fd;
+	while ((fd = accept(sv_listen_fd, nullptr, nullptr)) != -1)
+	{
+		sv_nonblock(fd);
+		sv_clients.emplace_back();
+		sv_clients.back().fd = fd;
+	}
+
+	// requests are run one at a time, in the order they came
+	for (int i = 0; i < (int)sv_clients.size(); i++)
+	{
+		char buffer[4096];
+		ssize_t length;
+		while ((length = recv(sv_clients.at(i).fd, buffer, sizeof(buffer), 0)) > 0)
+			sv_clients.at(i).in.append(buffer, length);
+		if ((length == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)))
+			sv_clients.at(i).gone = true;
+
+		size_t start = 0;
+		size_t end;
+		while ((end = sv_clients.at(i).in.find('\n', start)) != string::npos)
+		{
+			const string request = sv_clients.at(i).in.substr(start, end - start);
+			sv_run(sv_clients.at(i), request);
+			start = end + 1;
+		}
+		sv_clients.at(i).in.erase(0, start);
+	}
+
+	// a request changes what the others have to be sent
+	for (auto& client : sv_clients)
+	{
+		while (!client.out.empty())
+		{
+			const ssize_t sent = send(client.fd, client.out.data(), client.out.length(), MSG_NOSIGNAL);
+			if (sent <= 0)
+			{
+				if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)) client.gone = true;
+				break;
+			}
+
+			client.out.erase(0, sent);
+		}
+
+		if (client.out.size() > SV_CLIENT_BUFFER)
+		{
+			log("A client does not keep up with the changes. Dropped", LP_ERROR);
+			client.gone = true;
+		}
+	}
+
+	for (auto client = sv_clients.begin(); client != sv_clients.end(); )
+	{
+		if (client->gone)
+		{
+			sv_drop(*client);
+			client = sv_clients.erase(client);
+		} else client++;
+	}
+}
+
+// -1 if there's no daemon to connect to
+static int sv_dial()
+{
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) return -1;
+
+	const sockaddr_un addr = sv_address();
+	if (connect(fd, (const sockaddr*)&addr, sizeof(addr)) == -1)
+	{
+		close(fd);
+		return -1;
+	}
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	return fd;
+}
+
+static bool sv_write(const int& fd, const string& data)
+{
+	for (size_t sent = 0; sent < data.length(); )
+	{
+		const ssize_t length = send(fd, data.data() + sent, data.length() - sent, MSG_NOSIGNAL);
+		if (length < 0)
+		{
+			if (errno == EINTR) continue;
+			return false;
+		}
+
+		sent += length;
+	}
+
+	return true;
+}
+
+// 1 - read something, 0 - nothing to read (without "wait"), -1 - the daemon is gone
+static int sv_read(const bool& wait)
+{
+	char buffer[64 * 1024];
+	ssize_t length;
+	do length = recv(sv_fd, buffer, sizeof(buffer), wait ? 0 : MSG_DONTWAIT);
+	while ((length < 0) && (errno == EINTR));
+
+	if (length > 0)
+	{
+		sv_in.append(buffer, length);
+		return 1;
+	}
+
+	if ((length < 0) && !wait && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) return 0;
+	return -1;
+}
+
+// handle what the daemon sent. With a reply - wait for one and return
+// its text there, otherwise only what's read already. False if the daemon is gone
+static bool sv_receive(string* reply)
+{
+	while (true)
+	{
+		const size_t end = sv_in.find('\n');
+		if (end == string::npos)
+		{
+			const int status = sv_read(reply != nullptr);
+			if (status < 0) return false;
+			if (status == 0) return true;
+			continue;
+		}
+
+		const string line = sv_in.substr(0, end);
+		sv_in.erase(0, end + 1);
+		if (line.empty()) continue;
+
+		long generation = 0;
+		uint32_t changes = 0;
+		int offset = 0;
+
+		switch (line.at(0))
+		{
+			case SV_F_SNAPSHOT:
+			{
+				size_t length = 0;
+				sscanf(line.c_str() + 2, "%ld %u %zu", &generation, &changes, &length);
+
+				// sent right after the line
+				while (sv_in.length() < length)
+					if (sv_read(true) < 0) return false;
+
+				li_load_text(sv_in.substr(0, length));
+				sv_in.erase(0, length);
+
+				li_generation = generation;
+				li_changes = changes;
+				break;
+			}
+			case SV_F_CHANGE:
+				if ((sscanf(line.c_str() + 2, "%ld %u %n", &generation, &changes, &offset) < 2) || !li_apply_record(line.substr(2 + offset)))
+					log("Can't apply a change the daemon sent: " + line, LP_ERROR);
+
+				li_generation = generation;
+				li_changes = changes;
+				break;
+			case SV_F_REPLY:
+				if (reply == nullptr) break;
+
+				*reply = line;
+				return true;
+		}
+	}
+}
+
+// the daemon is gone: the list is changed the usual way from now on.
+// A one-shot client (sv_exec()) has no list of its own and just fails
+static bool sv_lost()
+{
+	close(sv_fd);
+	sv_fd = -1;
+	sv_in = "";
+
+	if (!sv_remote)
+	{
+		log("Lost the connection to the daemon", LP_ERROR);
+		return false;
+	}
+
+	log("Lost the connection to the daemon. The list file is read again", LP_ERROR);
+
+	sv_remote = false;
+	li_autosave = true;
+
+	li_load();
+
+	return false;
+}
+
+// send the requests and wait for their replies. Returns the code of the last one
+static bool sv_request(const vector<string>& requests, int& code, string& text)
+{
+	if (sv_fd == -1) return false;
+
+	string data;
+	for (const auto& request : requests) (data += request) += '\n';
+	if (!sv_write(sv_fd, data)) return sv_lost();
+
+	string reply;
+	for (int i = 0; i < (int)requests.size(); i++)
+		if (!sv_receive(&reply)) return sv_lost();
+
+	int offset = 0;
+	code = 1;
+	sscanf(reply.c_str() + 2, "%d %n", &code, &offset);
+	text = reply.substr(min(reply.length(), (size_t)(2 + offset)));
+
+	return true;
+}
+
+bool sv_connect()
+{
+	sv_fd = sv_dial();
+	if (sv_fd == -1) return false;
+
+	// changes made here would be overwritten
+	sv_remote = true;
+	li_autosave = false;
+
+	int code;
+	string text;
+	if (!sv_request({ string(1, SV_R_FEED) }, code, text)) return false;
+
+	log("Got the list from the daemon: " + to_string(t_list.size()) + " tasks");
+	return true;
+}
+
+bool sv_apply(const vector<string>& records)
+{
+	if (records.empty()) return true;
+
+	vector<string> requests;
+	requests.reserve(records.size());
+	for (const auto& record : records)
+		requests.push_back(string(1, SV_R_RECORD) + ' ' + record);
+
+	int code;
+	string text;
+	if (!sv_request(requests, code, text)) return false;
+
+	if (code != 0) log("The daemon did not make the change", LP_ERROR);
+	return true;
+}
+
+bool sv_bulk(const bool& begin)
+{
+	int code;
+	string text;
+	return sv_request({ string(1, begin ? SV_R_BULK_BEGIN : SV_R_BULK_END) }, code, text);
+}
+
+void sv_poll()
+{
+	if (sv_remote && !sv_receive(nullptr)) sv_lost();
+}
+
+int sv_exec(const string& command, string& status)
+{
+	int code = 1;
+
+	if (sv_remote)
+	{
+		if (!sv_request({ string(1, SV_R_EXEC) + ' ' + command }, code, status)) status = "Lost the connection to the daemon";
+		return code;
+	}
+
+	sv_fd = sv_dial();
+	if (sv_fd == -1)
+	{
+		status = "The daemon does not run in server mode";
+		return code;
+	}
+
+	if (!sv_request({ string(1, SV_R_EXEC) + ' ' + command }, code, status)) status = "Lost the connection to the daemon";
+
+	if (sv_fd != -1) close(sv_fd);
+	sv_fd = -1;
+
+	return code;
+}
+
+int sv_follow(const string& position)
+{
+	const int fd = sv_dial();
+	if (fd == -1)
+	{
+		log("The daemon does not run in server mode", LP_ERROR);
+		return 1;
+	}
+
+	string request(1, SV_R_FEED);
+	if (position != "")
+	{
+		string pos = position;
+		replace(pos.begin(), pos.end(), ':', ' ');
+		request += ' ' + pos;
+	}
+
+	if (!sv_write(fd, request + '\n'))
+	{
+		close(fd);
+		return 1;
+	}
+
+	char buffer[64 * 1024];
+	ssize_t length;
+	while (((length = recv(fd, buffer, sizeof(buffer), 0)) > 0) || ((length < 0) && (errno == EINTR)))
+		if (length > 0)
+		{
+			fwrite(buffer, 1, length, stdout);
+			fflush(stdout);
+		}
+
+	close(fd);
+	return 0;
+}
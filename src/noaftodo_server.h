@@ -0,0 +1,93 @@
+#ifndef NOAFTODO_SERVER_H
+#define NOAFTODO_SERVER_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+#include <poll.h>
+
+#include "noaftodo_daemon.h"
+
+// with "server" set, the daemon owns the list: clients change it
+// through this socket and the daemon saves it. There's one per list, see da_name()
+constexpr char SV_SOCKET_FILE[] = "/tmp/.noaftodo-socket";
+
+// requests, one per line: "<type> <argument>"
+constexpr char SV_R_EXEC = 'x';		// run a command, as if typed in the program
+constexpr char SV_R_RECORD = 'j';	// make the change a journal record tells about
+constexpr char SV_R_BULK_BEGIN = 'b';	// li_bulk_begin()
+constexpr char SV_R_BULK_END = 'e';	// li_bulk_end()
+constexpr char SV_R_FEED = 'f';		// "f [<generation> <changes>]" - subscribe to the changes made after that
+
+// what the daemon sends back
+constexpr char SV_F_REPLY = 'r';	// "r <code> <text>" - one per request, in order
+constexpr char SV_F_SNAPSHOT = 's';	// "s <generation> <changes> <length>", then the list file contents
+constexpr char SV_F_CHANGE = 'c';	// "c <generation> <changes> <journal record>"
+
+// changes kept for the clients that come back after a while.
+// The ones that missed more get the whole list
+constexpr int SV_FEED_KEEP = 4096;
+
+// a client that has more than that waiting to be sent to it is dropped, bytes
+constexpr size_t SV_CLIENT_BUFFER = 64 * 1024 * 1024;
+
+struct sv_client_s
+{
+	int fd = -1;
+	std::string in;			// read, up to the first request that's not whole
+	std::string out;		// not sent yet
+	bool subscribed = false;
+	bool gone = false;
+	int bulk = 0;			// bulk edits it started and did not end
+	int s_line = -1;		// its selected task, for the commands
+	uint64_t s_id = 0;
+};
+
+// a line of the feed and where the list is after it
+struct sv_change_s
+{
+	long generation;
+	uint32_t changes;
+	std::string line;
+};
+
+// the socket of a list and its clients, see sv_swap()
+struct sv_context_s
+{
+	int listen_fd = -1;
+	std::vector<sv_client_s> clients;
+
+	std::deque<sv_change_s> changes;
+	long base_generation = 0;	// where the list was before the first of changes
+	uint32_t base_changes = 0;
+};
+
+// daemon side
+void sv_swap(sv_context_s& context);	// serve another list, see li_swap()
+bool sv_open();		// start to listen. False if the socket can't be opened
+void sv_close();
+void sv_fds(std::vector<pollfd>& fds);	// what to wait for besides the message queue
+void sv_serve();	// take new clients, run their requests and send what's waiting
+void sv_feed(const da_message_s& message);	// a change the daemon made, for the subscribers
+
+// client side
+extern bool sv_remote;	// the list is a copy of the one the daemon has. Changes go to the daemon
+
+// connect to the daemon and get the list from it. False if there's no server
+bool sv_connect();
+
+// make the changes and wait till they come back in the feed. False if the
+// connection is lost: the list file is read again and changes are made here
+bool sv_apply(const std::vector<std::string>& records);
+bool sv_bulk(const bool& begin);
+
+void sv_poll();		// apply the changes others made, if there are any
+
+// run a command in the daemon. Status - what it says back
+int sv_exec(const std::string& command, std::string& status);
+
+// print the feed from the position ("<generation>:<changes>", "" - the whole list) on. Exits with the daemon
+int sv_follow(const std::string& position);
+
+#endif
@@ -0,0 +1,92 @@
+#include "noaftodo_stats.h"
+
+#include <map>
+#include <mutex>
+#include <sys/stat.h>
+
+#include "noaftodo_list.h"
+
+using namespace std;
+using namespace chrono;
+
+static mutex st_lock;		// guards everything below
+static map<string, uint64_t> st_counters;
+static map<string, int64_t> st_gauges;
+static map<string, st_histogram_s> st_histograms;
+
+static const steady_clock::time_point st_start = steady_clock::now();
+
+void st_count(const string& name, const uint64_t& n)
+{
+	lock_guard<mutex> lock(st_lock);
+	st_counters[name] += n;
+}
+
+void st_set(const string& name, const int64_t& value)
+{
+	lock_guard<mutex> lock(st_lock);
+	st_gauges[name] = value;
+}
+
+void st_time(const string& name, const steady_clock::time_point& start)
+{
+	const uint64_t us = duration_cast<microseconds>(steady_clock::now() - start).count();
+
+	int bucket = 0;
+	while ((bucket < ST_BUCKETS - 1) && (us >= ((uint64_t)1 << bucket))) bucket++;
+
+	lock_guard<mutex> lock(st_lock);
+	st_histogram_s& histogram = st_histograms[name];
+	histogram.count++;
+	histogram.sum += us;
+	histogram.max = max(histogram.max, us);
+	histogram.buckets[bucket]++;
+}
+
+// upper bound of the bucket the p'th percentile falls into, us
+static uint64_t st_percentile(const st_histogram_s& histogram, const int& p)
+{
+	const uint64_t rank = (histogram.count * p + 99) / 100;
+
+	uint64_t seen = 0;
+	for (int bucket = 0; bucket < ST_BUCKETS; bucket++)
+	{
+		seen += histogram.buckets[bucket];
+		if (seen >= rank) return min((uint64_t)1 << bucket, histogram.max);
+	}
+
+	return histogram.max;
+}
+
+string st_report()
+{
+	lock_guard<mutex> lock(st_lock);
+
+	string report = "uptime " + to_string(duration_cast<seconds>(steady_clock::now() - st_start).count()) + '\n';
+
+	for (const auto& counter : st_counters)
+		report += counter.first + ' ' + to_string(counter.second) + '\n';
+
+	for (const auto& gauge : st_gauges)
+		report += gauge.first + ' ' + to_string(gauge.second) + '\n';
+
+	for (const auto& entry : st_histograms)
+	{
+		const st_histogram_s& histogram = entry.second;
+		report += entry.first + " count=" + to_string(histogram.count) +
+			" mean=" + to_string(histogram.sum / max(histogram.count, (uint64_t)1)) +
+			" p50=" + to_string(st_percentile(histogram, 50)) +
+			" p90=" + to_string(st_percentile(histogram, 90)) +
+			" p99=" + to_string(st_percentile(histogram, 99)) +
+			" max=" + to_string(histogram.max) + '\n';
+	}
+
+	return report;
+}
+
+bool st_write(const string& filename)
+{
+	// readers never see half of it. The name is known to everyone:
+	// the report goes to a file of its own, renamed over whatever is there
+	return li_write_atomic(filename, st_report(), {}, S_IRUSR | S_IWUSR);
+}
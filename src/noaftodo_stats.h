@@ -0,0 +1,33 @@
+#ifndef NOAFTODO_STATS_H
+#define NOAFTODO_STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// durations are kept in buckets: bucket i counts the ones under 2^i us
+constexpr int ST_BUCKETS = 32;
+
+struct st_histogram_s
+{
+	uint64_t count = 0;
+	uint64_t sum = 0;	// us
+	uint64_t max = 0;	// us
+	uint64_t buckets[ST_BUCKETS] = {};
+};
+
+// counters, gauges and histograms of what the program spends its time on.
+// Any thread can touch them
+void st_count(const std::string& name, const uint64_t& n = 1);
+void st_set(const std::string& name, const int64_t& value);
+void st_time(const std::string& name, const std::chrono::steady_clock::time_point& start);	// it took from start till now
+
+// one line per metric: "<name> <value>", histograms:
+// "<name> count=<n> mean=<us> p50=<us> p90=<us> p99=<us> max=<us>".
+// Percentiles are upper bounds of the buckets they fall into
+std::string st_report();
+
+// write the report to a file. It's replaced as a whole
+bool st_write(const std::string& filename);
+
+#endif
@@ -1,121 +1,158 @@
 #include "noaftodo_time.h"
 
+#include <mutex>
+#include <unordered_map>
+
 using namespace std;
 using namespace chrono;
 
+ti_snapshot_s ti_snapshot()
+{
+	ti_snapshot_s ret;
+	ret.time = system_clock::to_time_t(system_clock::now());
+
+	tm l_ti = *localtime(&ret.time);
+
+	l_ti.tm_mon += 1;
+	l_ti.tm_year += 1900;
+	ret.now = ti_to_long(l_ti);
+
+	// same wall clock time the next day
+	ret.coming = ti_from_minutes(ti_to_minutes(ret.now) + 24 * 60);
+
+	return ret;
+}
+
 long ti_to_long(const tm& t_tm)
 {
-	return t_tm.tm_min + t_tm.tm_hour * 1e2 + t_tm.tm_mday * 1e4 + t_tm.tm_mon * 1e6 + t_tm.tm_year * 1e8;
+	return ti_pack(t_tm.tm_year, t_tm.tm_mon, t_tm.tm_mday, t_tm.tm_hour, t_tm.tm_min);
 }
 
 long ti_to_long(const string& t_str)
 {
-	return ti_to_long(ti_to_tm(t_str));
+	return ti_eval(ti_expr(t_str), ti_snapshot().now);
+}
+
+long ti_to_long(const string& t_str, const long& now)
+{
+	return ti_eval(ti_expr(t_str), now);
 }
 
 tm ti_to_tm(const string& t_str)
 {
-	tm ti = {0};
-	const time_t t = system_clock::to_time_t(system_clock::now());
-	tm l_ti = *localtime(&t);
-	l_ti.tm_mon += 1;
-	l_ti.tm_year += 1900;
+	return ti_to_tm(ti_to_long(t_str));
+}
 
-	int year = 0;
-	int month = 0;
-	int day = 0;
-	int hour = 0;
-	int minute = 0;
+ti_expr_s ti_compile(const string& t_str)
+{
+	ti_expr_s expr;
 
-	bool c_year = false;
-	bool c_mon = false;
-	bool c_day = false;
-	bool c_hour = false;
-	bool c_min = false;
+	int64_t value = 0;
+	bool c_value = false;		// digits since the last letter
+	bool set[TI_FIELDS] = {};
 
-	for (int i = 0; i <= t_str.length(); i++)
+	for (int i = 0; i <= (int)t_str.length(); i++)
 	{
-		const char c = (i == t_str.length()) ? 'a' : t_str.at(i);
+		const char c = (i == (int)t_str.length()) ? 'a' : t_str.at(i);
 
-		if (isdigit(c)) { minute = minute * 10 + (c - '0'); c_min = true; }
-		else 
+		if (isdigit(c)) { value = value * 10 + (c - '0'); c_value = true; }
+		else
 		{
+			int field = -1;
 			switch (c)
 			{
 				case 'a':
-					if (!c_year) ti.tm_year = l_ti.tm_year;
-					if (!c_mon) ti.tm_mon = l_ti.tm_mon;
-					if (!c_day) ti.tm_mday = l_ti.tm_mday;
-					if (!c_hour) ti.tm_hour = l_ti.tm_hour;
-					if (!c_min) ti.tm_min = l_ti.tm_min;
-					break;
-				case 'h':
-					hour = minute;
-					c_hour = true;
-
-					minute = 0;
-					break;
-				case 'd':
-					day = minute;
-					c_day = true;
-
-					minute = 0;
-					break;
-				case 'm':
-					month = minute;
-					c_mon = true;
-
-					minute = 0;
+					// fields not given yet start at the current time
+					for (int f = 0; f < TI_MINUTE; f++)
+						if (!set[f]) expr.now[f] = true;
+					if (!c_value) expr.now[TI_MINUTE] = true;
 					break;
-				case 'y':
-					year = minute;
-					c_year = true;
+				case 'y': field = TI_YEAR; break;
+				case 'm': field = TI_MONTH; break;
+				case 'd': field = TI_DAY; break;
+				case 'h': field = TI_HOUR; break;
+			}
 
-					minute = 0;
-					break;
+			if (field != -1)
+			{
+				expr.delta[field] = value;
+				set[field] = true;
+				value = 0;
 			}
 
-			c_min = false;
+			c_value = false;
 		}
 	}
 
-	ti.tm_year += year;
-	ti.tm_mon += month;
-	ti.tm_mday += day;
-	ti.tm_hour += hour;
-	ti.tm_min += minute;
-	ti.tm_sec = 0;
-
-	if (ti.tm_min >= 60) { ti.tm_hour += ti.tm_min / 60; ti.tm_min = ti.tm_min % 60; }
-	if (ti.tm_hour >= 24) { ti.tm_mday += ti.tm_hour / 24; ti.tm_hour = ti.tm_hour % 24; }
-	int days_in_month = (ti.tm_mon == 2) ? ((ti.tm_year % 4 == 0) ? 29 : 28) : ((ti.tm_mon <= 7) ? (30 + (ti.tm_mon % 2)) : (31 - (ti.tm_mon % 2)));
-	while (ti.tm_mday > days_in_month)
-	{
-		ti.tm_mday -= days_in_month;
-		ti.tm_mon++;
+	// digits after the last letter are minutes
+	expr.delta[TI_MINUTE] = value;
 
-		days_in_month = (ti.tm_mon == 2) ? ((ti.tm_year % 4 == 0) ? 29 : 28) : ((ti.tm_mon <= 7) ? (30 + (ti.tm_mon % 2)) : (31 - (ti.tm_mon % 2)));
-	}
+	return expr;
+}
 
-	if (ti.tm_mon > 12) { ti.tm_year += ti.tm_mon / 12; ti.tm_mon = ti.tm_mon % 12; }
+long ti_eval(const ti_expr_s& expr, const long& now)
+{
+	const int64_t current[TI_FIELDS] = { now / 100000000L, now / 1000000L % 100, now / 10000L % 100, now / 100 % 100, now % 100 };
+
+	int64_t fields[TI_FIELDS];
+	for (int f = 0; f < TI_FIELDS; f++)
+		fields[f] = (expr.now[f] ? current[f] : 0) + expr.delta[f];
+
+	// years and months move the date in the calendar,
+	// the rest is added as minutes
+	const int64_t months = fields[TI_YEAR] * 12 + (fields[TI_MONTH] - 1);
+	const int64_t months_year = ((months >= 0) ? months : (months - 11)) / 12;
 
-	return ti;
+	const int64_t minutes = (ti_days_from_civil(months_year, months - months_year * 12 + 1, 1) + (fields[TI_DAY] - 1)) * 1440 +
+		fields[TI_HOUR] * 60 + fields[TI_MINUTE];
+
+	return ti_from_minutes(minutes);
+}
+
+ti_expr_s ti_expr(const string& t_str)
+{
+	static mutex lock;
+	static unordered_map<string, ti_expr_s> cache;
+	lock_guard<mutex> guard(lock);
+
+	const auto cached = cache.find(t_str);
+	if (cached != cache.end()) return cached->second;
+
+	// typed in times are all different. The ones from binds and cvars come back
+	if (cache.size() >= TI_EXPR_CACHE) cache.clear();
+
+	return cache[t_str] = ti_compile(t_str);
 }
 
 tm ti_to_tm(const long& t_long)
 {
-	tm ret = { 0 };
+	tm ret = { };
 
 	ret.tm_sec = 0;
-	ret.tm_min = t_long % (long)1e2;
-	ret.tm_hour = t_long % (long)1e4 / 1e2;
-	ret.tm_mday = t_long % (long)1e6 / 1e4;
-	ret.tm_mon = t_long % (long)1e8 / 1e6;
-	ret.tm_year = t_long / (long)1e8;
+	ret.tm_min = t_long % 100;
+	ret.tm_hour = t_long / 100 % 100;
+	ret.tm_mday = t_long / 10000 % 100;
+	ret.tm_mon = t_long / 1000000 % 100;
+	ret.tm_year = t_long / 100000000;
 
 	return ret;
 }
 
+time_t ti_to_time(const tm& t_tm)
+{
+	tm ti = t_tm;
+	ti.tm_year -= 1900;
+	ti.tm_mon -= 1;
+	ti.tm_isdst = -1;
+
+	return mktime(&ti);
+}
+
+time_t ti_to_time(const long& t_long)
+{
+	return ti_to_time(ti_to_tm(t_long));
+}
+
 string ti_f_str(const tm& t_tm)
 {
 	const auto t_str = [](const int& integer)
@@ -2,13 +2,116 @@
 #define NOAFTODO_TIME_H
 
 #include <chrono>
+#include <cstdint>
 #include <string>
 
+// the current time, taken once per frame (or daemon tick),
+// so that every task is looked at against the same time
+struct ti_snapshot_s
+{
+	time_t time = 0;
+	long now = 0;		// a task due by then is failed
+	long coming = 0;	// a day later. A task due by then is coming
+};
+
+ti_snapshot_s ti_snapshot();
+
+// dues are kept as YYYYMMDDhhmm local time, which compares the same way as the
+// time itself. Calendar math is done on minutes since 1970-01-01 00:00 of the
+// same (zoneless) calendar, with the proleptic Gregorian leap years
+
+struct ti_date_s
+{
+	int64_t year;
+	int64_t month;	// 1 - 12
+	int64_t day;	// 1 - 31
+};
+
+// days since 1970-01-01. Days past the end of the month count into the next one
+constexpr int64_t ti_days_from_civil(int64_t year, const int64_t& month, const int64_t& day)
+{
+	// years start in March, so that the leap day is the last one
+	year -= (month <= 2);
+	const int64_t era = ((year >= 0) ? year : (year - 399)) / 400;
+	const int64_t year_of_era = year - era * 400;
+	const int64_t day_of_year = (153 * (month + ((month > 2) ? -3 : 9)) + 2) / 5 + day - 1;
+	const int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+
+	return era * 146097 + day_of_era - 719468;
+}
+
+constexpr ti_date_s ti_civil_from_days(int64_t days)
+{
+	days += 719468;
+	const int64_t era = ((days >= 0) ? days : (days - 146096)) / 146097;
+	const int64_t day_of_era = days - era * 146097;
+	const int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+	const int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+	const int64_t month = (5 * day_of_year + 2) / 153;
+
+	return { year_of_era + era * 400 + ((month >= 10) ? 1 : 0),
+		month + ((month < 10) ? 3 : -9),
+		day_of_year - (153 * month + 2) / 5 + 1 };
+}
+
+constexpr long ti_pack(const int64_t& year, const int64_t& month, const int64_t& day, const int64_t& hour, const int64_t& minute)
+{
+	return year * 100000000L + month * 1000000L + day * 10000L + hour * 100L + minute;
+}
+
+constexpr int64_t ti_to_minutes(const long& t_long)
+{
+	return ti_days_from_civil(t_long / 100000000L, t_long / 1000000L % 100, t_long / 10000L % 100) * 1440 +
+		t_long / 100 % 100 * 60 + t_long % 100;
+}
+
+constexpr long ti_from_minutes(const int64_t& minutes)
+{
+	const int64_t days = ((minutes >= 0) ? minutes : (minutes - 1439)) / 1440;
+	const int64_t minute_of_day = minutes - days * 1440;
+	const ti_date_s date = ti_civil_from_days(days);
+
+	return ti_pack(date.year, date.month, date.day, minute_of_day / 60, minute_of_day % 60);
+}
+
+static_assert(ti_days_from_civil(1970, 1, 1) == 0, "days_from_civil");
+static_assert(ti_from_minutes(ti_to_minutes(202402282330L) + 60) == 202402290030L, "leap day");
+static_assert(ti_from_minutes(ti_to_minutes(210002282330L) + 60) == 210003010030L, "not a leap year");
+static_assert(ti_from_minutes(ti_to_minutes(200001010000L) - 1) == 199912312359L, "minutes before midnight");
+
+// fields of a time expression
+constexpr int TI_YEAR = 0;
+constexpr int TI_MONTH = 1;
+constexpr int TI_DAY = 2;
+constexpr int TI_HOUR = 3;
+constexpr int TI_MINUTE = 4;
+constexpr int TI_FIELDS = 5;
+
+// compiled expressions kept by ti_expr()
+constexpr size_t TI_EXPR_CACHE = 256;
+
+// a time expression ("a1d", "2d3h", "2099y1m1d12h00", see README), parsed:
+// every field is the current one (if "now" is set) or 0, plus a delta
+struct ti_expr_s
+{
+	bool now[TI_FIELDS] = {};
+	int64_t delta[TI_FIELDS] = {};
+};
+
+ti_expr_s ti_compile(const std::string& t_str);
+ti_expr_s ti_expr(const std::string& t_str);	// compiled once and cached
+long ti_eval(const ti_expr_s& expr, const long& now);	// the time it means at "now" (YYYYMMDDhhmm)
+
 long ti_to_long(const tm& t_tm);
-long ti_to_long(const std::string& t_str);
+long ti_to_long(const std::string& t_str);			// at the current time
+long ti_to_long(const std::string& t_str, const long& now);
 tm ti_to_tm(const std::string& t_str);
 tm ti_to_tm(const long& t_long);
 
+// seconds since the epoch of a local time
+time_t ti_to_time(const tm& t_tm);
+time_t ti_to_time(const long& t_long);
+
 std::string ti_f_str(const tm& t_tm);
 std::string ti_f_str(const long& t_long);
 
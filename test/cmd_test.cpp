@@ -0,0 +1,91 @@
+#include "test.h"
+
+#include <string>
+
+#include "../src/noaftodo_cmd.h"
+#include "../src/noaftodo_config.h"
+#include "../src/noaftodo_cui.h"
+#include "../src/noaftodo_list.h"
+
+using namespace std;
+
+static string filename;
+
+// position of the task with the title, -1 if there's none
+static int find_title(const string& title)
+{
+	for (int i = 0; i < (int)t_list.size(); i++)
+		if (t_list.at(i).title == title) return i;
+
+	return -1;
+}
+
+// commands from the config, scripts and -x run before anything was selected
+static void test_selection()
+{
+	conf_set_cvar("autosave_delay", "0");
+
+	te_section("selection: nothing selected yet means the selected line");
+	te_reset(filename);
+	cmd_exec("a 2030y1m1d12h00 first description; a 2040y1m1d12h00 second description");
+	cui_s_line = 0;
+	cui_s_id = 0;
+	TE_CHECK(cmd_exec("c") == 0);
+	TE_CHECK((find_title("first") != -1) && t_list.at(find_title("first")).completed);
+
+	cui_s_id = 0;
+	TE_CHECK(cmd_exec("lmv 3") == 0);
+	TE_CHECK((find_title("first") != -1) && (t_list.at(find_title("first")).tag == 3));
+
+	cui_s_id = 0;
+	TE_CHECK(cmd_exec("d") == 0);
+	TE_CHECK((t_list.size() == 1) && (find_title("first") == -1));
+}
+
+static void test_bulk()
+{
+	conf_set_cvar("autosave_delay", "0");
+
+	te_section("bulk: positions after adds mean what they would in separate commands");
+	te_reset(filename);
+	cmd_exec("a 2030y1m1d12h00 middle description");
+	cmd_exec("a 2040y1m1d12h00 late description; a 2020y1m1d12h00 early description; g 0");
+	TE_CHECK(t_list.size() == 3);
+	TE_CHECK((cui_s_line == 0) && (find_title("early") == 0));
+	TE_CHECK((find_title("early") != -1) && (cui_s_id == t_list.at(find_title("early")).id));
+
+	// the selected one is the one that's removed
+	cmd_exec("a 2010y1m1d12h00 earliest description; g 0; d");
+	TE_CHECK(t_list.size() == 3);
+	TE_CHECK(find_title("earliest") == -1);
+	TE_CHECK(find_title("early") == 0);
+
+	cmd_exec("g 2; a 2000y1m1d12h00 first description; g 1; c");
+	TE_CHECK((find_title("first") == 0) && (find_title("early") == 1));
+	TE_CHECK((find_title("early") != -1) && t_list.at(find_title("early")).completed);
+
+	cmd_exec("a 2050y1m1d12h00 last description; g 4; lmv 2");
+	TE_CHECK((find_title("last") == 4) && (t_list.at(4).tag == 2));
+
+	te_section("bulk: saved once");
+	li_flush();
+	const long generation = li_generation;
+	cmd_exec("a 2031y1m1d12h00 one description; a 2032y1m1d12h00 two description; a 2033y1m1d12h00 three description");
+	li_flush();
+	TE_CHECK(li_generation == generation + 1);
+
+	li_load(filename);
+	TE_CHECK(t_list.size() == 8);
+	for (int i = 1; i < (int)t_list.size(); i++) TE_CHECK(t_list.at(i - 1).due <= t_list.at(i).due);
+}
+
+int main()
+{
+	te_init("cmd_test");
+	filename = te_dir() + "list";
+
+	test_selection();
+	test_bulk();
+
+	return te_done();
+}
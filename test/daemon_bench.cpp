@@ -0,0 +1,125 @@
+#include "test.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../src/noaftodo_config.h"
+#include "../src/noaftodo_daemon.h"
+#include "../src/noaftodo_list.h"
+
+using namespace std;
+
+// daemon_bench [tasks [rounds]]: time the daemon looking at a list of that
+// many tasks. Every round, a task is changed and the daemon is told about
+// it, then the list file is written by someone else and read again
+constexpr int DB_TASKS = 100000;
+constexpr int DB_ROUNDS = 10;
+
+// a field of a histogram line of the stats, 0 if it's not there
+static double db_field(const string& report, const string& name, const string& field)
+{
+	const size_t line = report.find(name + " count=");
+	if (line == string::npos) return 0;
+
+	const size_t pos = report.find(field + "=", line);
+	if ((pos == string::npos) || (pos > report.find('\n', line))) return 0;
+
+	return atof(report.c_str() + pos + field.length() + 1);
+}
+
+// the daemon stats once the histogram has that many
+static string db_wait(const string& name, const int& count)
+{
+	string report;
+	for (int i = 0; i < 1000; i++)
+	{
+		if (da_stats(report) && (db_field(report, name, "count") >= count)) return report;
+		usleep(10000);
+	}
+
+	cerr << "daemon_bench: the daemon did not get to " << name << endl;
+	return report;
+}
+
+// tasks - the ones every run looks at, 0 - only a few
+static void db_report(const string& report, const string& name, const string& what, const int& tasks)
+{
+	const double mean = db_field(report, name, "mean");
+	cerr << "  " << what << ": mean " << (mean / 1000) << " ms, ";
+	if (tasks > 0) cerr << (mean * 1000 / tasks) << " ns per task, ";
+	cerr << "p99 < " << (db_field(report, name, "p99") / 1000) << " ms (" << (long)db_field(report, name, "count") << " runs)" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	const int tasks = (argc > 1) ? atoi(argv[1]) : DB_TASKS;
+	const int rounds = (argc > 2) ? atoi(argv[2]) : DB_ROUNDS;
+
+	te_init("daemon_bench");
+	conf_set_cvar("autosave_delay", "0");
+
+	// only the diff is timed: no actions are run
+	conf_set_cvar("on_daemon_launch_action", "");
+	for (const string kind : { "completed", "uncompleted", "failed", "coming", "new", "removed" })
+		conf_set_cvar("on_task_" + kind + "_action", "");
+
+	// the same list every run, as in list_bench
+	mt19937_64 rng(1);
+	li_autosave = false;
+	li_load(te_dir() + "list");
+
+	vector<noaftodo_entry> entries;
+	vector<string> strings;
+	strings.reserve(tasks * 2);
+	for (int i = 0; i < tasks; i++)
+	{
+		strings.push_back("task " + to_string(rng() % (tasks / 4 + 1)));
+		strings.push_back("description of task " + to_string(i) + ", a line or so of text to go with it");
+
+		const long due = ti_from_minutes(ti_to_minutes(202001010000L) + (int64_t)(rng() % (20 * 365 * 1440)));
+		entries.push_back({ rng() % 10 == 0, due, strings.at(i * 2), strings.at(i * 2 + 1), (int)(rng() % 8), 0 });
+	}
+
+	li_add(entries);
+	li_save();
+	li_autosave = true;
+
+	cerr << "daemon_bench: " << tasks << " tasks, " << rounds << " rounds" << endl;
+
+	const pid_t pid = fork();
+	if (pid == 0)
+	{
+		da_run({ li_filename });
+		_exit(0);
+	}
+
+	db_wait("daemon.diff", 1);
+
+	for (int round = 0; round < rounds; round++)
+	{
+		// the daemon applies the change it's told about and looks at that task only
+		li_comp(t_list.at(rng() % t_list.size()).id);
+		li_flush();
+		db_wait("daemon.diff", round + 1);
+
+		// a file it does not know: it's read again and every task is looked at
+		te_write(li_filename, te_read(li_filename));
+		db_wait("daemon.diff", round + 2);
+	}
+
+	const string report = db_wait("daemon.diff", rounds + 1);
+	db_report(report, "list.reload", "list read again", tasks);
+	db_report(report, "daemon.diff", "diff of every task", tasks);
+	// every tick that did not read the list: the ones with a change and the ones the stats were asked in
+	db_report(report, "daemon.diff_changes", "diff of the changes", 0);
+
+	da_kill();
+	waitpid(pid, nullptr, 0);
+
+	return te_done();
+}
@@ -0,0 +1,266 @@
+#include "test.h"
+
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../src/noaftodo_config.h"
+#include "../src/noaftodo_daemon.h"
+#include "../src/noaftodo_list.h"
+#include "../src/noaftodo_server.h"
+#include "../src/noaftodo_time.h"
+
+using namespace std;
+using namespace chrono;
+
+static string filename;
+static string actions;		// the actions write to it
+static string state;		// the state file of the daemon
+
+// times the action was run
+static int count(const string& action)
+{
+	const string contents = te_read(actions);
+	int ret = 0;
+	for (size_t pos = 0; (pos = contents.find(action + "\n", pos)) != string::npos; pos++)
+		if ((pos == 0) || (contents.at(pos - 1) == '\n')) ret++;
+
+	return ret;
+}
+
+// wait until it's so, for at most 5 s
+static bool wait_for(const function<bool()>& ready)
+{
+	for (int i = 0; i < 500; i++)
+	{
+		if (ready()) return true;
+		this_thread::sleep_for(milliseconds(10));
+	}
+
+	return ready();
+}
+
+// a counter of the running daemon, 0 if it's not there
+static long stat(const string& name)
+{
+	string report;
+	if (!da_stats(report)) return 0;
+
+	const size_t line = report.find("\n" + name + " ");
+	return (line == string::npos) ? 0 : atol(report.c_str() + line + name.length() + 2);
+}
+
+// times the daemon timed it, 0 if it did not
+static long runs(const string& name)
+{
+	string report;
+	if (!da_stats(report)) return 0;
+
+	const size_t line = report.find("\n" + name + " count=");
+	return (line == string::npos) ? 0 : atol(report.c_str() + line + name.length() + 8);
+}
+
+// the daemon has looked at the list
+static bool diffed()
+{
+	string report;
+	return da_stats(report) && (report.find("\ndaemon.diff count=") != string::npos);
+}
+
+static pid_t start()
+{
+	li_flush();
+
+	const pid_t pid = fork();
+	if (pid == 0)
+	{
+		da_run({ filename });
+		_exit(0);
+	}
+
+	return pid;
+}
+
+// as if the machine went down: nothing is cleaned up but the lock file
+static void crash(const pid_t& pid)
+{
+	kill(pid, SIGKILL);
+	waitpid(pid, nullptr, 0);
+	da_unlock();
+}
+
+static void stop(const pid_t& pid)
+{
+	da_kill();
+	waitpid(pid, nullptr, 0);
+}
+
+static void test_resume()
+{
+	conf_set_cvar("on_daemon_launch_action", "");
+	for (const string kind : { "completed", "uncompleted", "failed", "coming", "new", "removed" })
+		conf_set_cvar("on_task_" + kind + "_action", "!echo \"" + kind + " %T%\" >> " + actions);
+
+	li_load(filename);
+	li_add({ false, 200001011200L, "past", "", 0, 0 });
+	li_add({ false, 209901011200L, "future", "", 0, 0 });
+
+	te_section("resume: the state is written");
+	pid_t pid = start();
+	TE_CHECK(wait_for([]() { return count("failed past") == 1; }));
+	TE_CHECK(wait_for([]() { return te_read(state).length() > 8; }));
+
+	te_section("resume: after a crash, only what changed while it was down");
+	crash(pid);
+	li_add({ false, 209901011200L, "while down", "", 0, 0 });
+	pid = start();
+	TE_CHECK(wait_for([]() { return count("new while down") == 1; }));
+	this_thread::sleep_for(milliseconds(300));
+	TE_CHECK(count("failed past") == 1);
+	TE_CHECK(count("new future") <= 1);
+
+	te_section("resume: a state file cut short");
+	li_add({ false, 209901011200L, "appended", "", 0, 0 });
+	TE_CHECK(wait_for([]() { return count("new appended") == 1; }));
+	crash(pid);
+
+	const string whole = te_read(state);
+	te_write(state, whole.substr(0, whole.length() - 5));
+	pid = start();
+	this_thread::sleep_for(milliseconds(500));
+	TE_CHECK(count("failed past") == 1);
+	TE_CHECK(count("new while down") == 1);
+
+	// and it goes on from there
+	li_comp(t_list.at(0).id);
+	TE_CHECK(wait_for([]() { return count("completed past") == 1; }));
+
+	te_section("resume: nothing is left behind");
+	stop(pid);
+	bool temp = false;
+	const string state_name = state.substr(state.rfind('/') + 1);
+	for (const auto& entry : filesystem::directory_iterator(te_dir()))
+	{
+		const string name = entry.path().filename().string();
+		temp = temp || ((name.compare(0, state_name.length(), state_name) == 0) && (name != state_name));
+	}
+	TE_CHECK(!temp);
+
+	te_section("resume: with nothing changed, no task is looked at again");
+	pid = start();
+	TE_CHECK(wait_for(diffed));
+	TE_CHECK(stat("daemon.scheduled") == 0);
+	TE_CHECK(stat("daemon.state_records") == 0);
+	li_add({ false, 209901011200L, "after resume", "", 0, 0 });
+	TE_CHECK(wait_for([]() { return stat("daemon.state_records") == 1; }));
+	stop(pid);
+
+	te_section("resume: a damaged state file is not read");
+	string damaged = te_read(state);
+	damaged.at(0) = 'X';
+	te_write(state, damaged);
+	pid = start();
+	// as on the first start: the completed task is reported again
+	TE_CHECK(wait_for([]() { return count("completed past") == 2; }));
+	stop(pid);
+}
+
+static void test_events()
+{
+	// the list is not looked at by the clock
+	const int interval = da_interval;
+	da_interval = DA_MAX_SLEEP;
+	li_load(filename);
+
+	te_section("events: the daemon does nothing while nothing happens");
+	const pid_t pid = start();
+	TE_CHECK(wait_for(diffed));
+	const long before = runs("daemon.diff_changes");
+	this_thread::sleep_for(seconds(2));
+	// the only tick is the one that came with the first request for the stats
+	TE_CHECK(runs("daemon.diff_changes") - before <= 1);
+
+	te_section("events: a list file changed by someone else is read at once");
+	li_flush();
+	string contents = te_read(filename);
+	const size_t list = contents.find("[list]\n");
+	TE_CHECK(list != string::npos);
+	if (list != string::npos)
+	{
+		contents.insert(list + 7, "-\\209901011200\\by hand\\\\0\\\n");
+		te_write(filename, contents);
+	}
+	TE_CHECK(wait_for([]() { return count("new by hand") == 1; }));
+	li_load();
+
+	te_section("events: the daemon sleeps until the next task changes its state");
+	const string deadline = "daemon.next_deadline[" + filename + "]";
+	const long scheduled = stat("daemon.scheduled");
+	TE_CHECK(stat(deadline) == ti_to_time(209812311200L));	// "future" is coming a day before its due
+	li_add({ false, 205001011200L, "sooner", "", 0, 0 });
+	TE_CHECK(wait_for([&deadline]() { return stat(deadline) == ti_to_time(204912311200L); }));
+	// only the task added is looked at
+	TE_CHECK(stat("daemon.scheduled") - scheduled == 1);
+
+	te_section("events: changes are applied from the messages, the list file is not read");
+	TE_CHECK(wait_for([]() { return count("new sooner") == 1; }));
+	const long reloads = stat("list.reloads");
+	li_add({ false, 209901011200L, "by message", "", 0, 0 });
+	TE_CHECK(wait_for([]() { return count("new by message") == 1; }));
+	li_flush();
+	this_thread::sleep_for(milliseconds(300));
+	TE_CHECK(stat("list.reloads") == reloads);
+
+	te_section("events: a change too long for a message is read from the file");
+	const string title(DA_MSGSIZE, 'x');
+	li_add({ false, 209901011200L, title, "", 0, 0 });
+	TE_CHECK(wait_for([&title]() { return count("new " + title) == 1; }));
+	TE_CHECK(stat("list.reloads") > reloads);
+
+	stop(pid);
+	da_interval = interval;
+}
+
+static void test_server()
+{
+	conf_set_cvar("server", "true");
+	li_load(filename);
+
+	te_section("server: commands of the console UI are refused");
+	const pid_t pid = start();
+	string status;
+	TE_CHECK(wait_for([&status]() { return sv_exec("g 0", status) == 0; }));
+	TE_CHECK(sv_exec(":", status) != 0);
+	TE_CHECK(sv_exec("?", status) != 0);
+	TE_CHECK(sv_exec("details", status) != 0);
+	TE_CHECK(waitpid(pid, nullptr, WNOHANG) == 0);
+
+	te_section("server: moving the selection with every task filtered out");
+	TE_CHECK(sv_exec("set filter 0", status) == 0);
+	TE_CHECK(sv_exec("down; up", status) == 0);
+	TE_CHECK(waitpid(pid, nullptr, WNOHANG) == 0);
+	TE_CHECK(sv_exec("g 0", status) == 0);
+
+	stop(pid);
+	conf_set_cvar("server", "false");
+}
+
+int main()
+{
+	te_init("daemon_test");
+	filename = te_dir() + "list";
+	actions = te_dir() + "actions";
+	state = te_dir() + ".list" + DA_STATE_SUFFIX;
+
+	test_resume();
+	test_events();
+	test_server();
+
+	return te_done();
+}
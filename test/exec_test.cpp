@@ -0,0 +1,107 @@
+#include "test.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <sys/stat.h>
+
+#include "../src/noaftodo_config.h"
+#include "../src/noaftodo_exec.h"
+#include "../src/noaftodo_stats.h"
+
+using namespace std;
+using namespace chrono;
+
+static bool exists(const string& filename)
+{
+	struct stat st;
+	return stat(filename.c_str(), &st) == 0;
+}
+
+// a counter from the stats, 0 if it's not there
+static long stat(const string& name)
+{
+	const string report = st_report();
+	const size_t line = report.find(name + " ");
+	return (line == string::npos) ? 0 : atol(report.c_str() + line + name.length() + 1);
+}
+
+// s it takes
+static double flush()
+{
+	const auto start = steady_clock::now();
+	ex_flush();
+	return duration<double>(steady_clock::now() - start).count();
+}
+
+static void test_pool()
+{
+	ex_async = true;
+	conf_set_cvar("exec_jobs", "2");
+	conf_set_cvar("exec_timeout", "30");
+	conf_set_cvar("exec_flush_timeout", "10");
+
+	te_section("pool: every action is run");
+	for (int i = 0; i < 10; i++) ex_run("touch " + te_dir() + "action" + to_string(i));
+	flush();
+	bool all = true;
+	for (int i = 0; i < 10; i++) all = all && exists(te_dir() + "action" + to_string(i));
+	TE_CHECK(all);
+
+	te_section("pool: shell commands");
+	ex_run("echo \"one; two\" > " + te_dir() + "shell");
+	flush();
+	TE_CHECK(te_read(te_dir() + "shell") == "one; two\n");
+
+	te_section("pool: sleeps while the actions run");
+	const long wakeups = stat("exec.wakeups");
+	ex_run("sleep 1");
+	ex_run("sleep 1");
+	const double took = flush();
+	TE_CHECK((took >= 0.9) && (took < 5));
+	// woken up by the children, not every few ms
+	TE_CHECK(stat("exec.wakeups") - wakeups < 20);
+
+	te_section("pool: actions that take too long are stopped");
+	conf_set_cvar("exec_timeout", "1");
+	ex_run("sleep 20");
+	TE_CHECK(flush() < 5);
+
+	te_section("pool: ex_flush() does not wait forever");
+	conf_set_cvar("exec_timeout", "0");
+	conf_set_cvar("exec_flush_timeout", "1");
+	ex_run("sleep 3");
+	ex_run("sleep 3");
+	ex_run("touch " + te_dir() + "dropped");
+	const double gave_up = flush();
+	TE_CHECK((gave_up >= 0.9) && (gave_up < 2.5));
+	TE_CHECK(!exists(te_dir() + "dropped"));
+
+	// and the pool still works
+	conf_set_cvar("exec_timeout", "30");
+	ex_run("touch " + te_dir() + "after");
+	conf_set_cvar("exec_flush_timeout", "10");
+	flush();
+	TE_CHECK(exists(te_dir() + "after"));
+
+	te_section("pool: the queue is bounded");
+	conf_set_cvar("exec_jobs", "1");
+	conf_set_cvar("exec_queue", "2");
+	conf_set_cvar("exec_overflow", "drop_new");
+	const long dropped = stat("exec.dropped");
+	ex_run("sleep 0.5");
+	for (int i = 0; i < 5; i++) ex_run("touch " + te_dir() + "queued" + to_string(i));
+	flush();
+	TE_CHECK(stat("exec.dropped") - dropped >= 3);
+	TE_CHECK(exists(te_dir() + "queued0"));
+	TE_CHECK(!exists(te_dir() + "queued4"));
+}
+
+int main()
+{
+	te_init("exec_test");
+
+	test_pool();
+
+	return te_done();
+}
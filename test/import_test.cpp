@@ -0,0 +1,190 @@
+#include "test.h"
+
+#include <string>
+
+#include "../src/noaftodo_config.h"
+#include "../src/noaftodo_import.h"
+#include "../src/noaftodo_list.h"
+
+using namespace std;
+
+static string filename;
+
+// position of the task with the title, -1 if there's none
+static int find_title(const string& title)
+{
+	for (int i = 0; i < (int)t_list.size(); i++)
+		if (t_list.at(i).title == title) return i;
+
+	return -1;
+}
+
+static int imports = 0;
+
+// import the contents into an empty list. Every import reads a file of its own
+static int import(const string& contents)
+{
+	te_reset(filename);
+
+	imports++;
+	const string i_filename = te_dir() + "import-" + to_string(imports);
+	te_write(i_filename, contents);
+	return im_import(i_filename);
+}
+
+// the log has the line of the last import file
+static bool logged(const int& line)
+{
+	return te_read(te_dir() + "import_test.log").find("import-" + to_string(imports) + ":" + to_string(line) + ": ") != string::npos;
+}
+
+static void test_csv()
+{
+	te_section("CSV: quoted fields");
+	TE_CHECK(import("due,title,description,tag,completed\n"
+			"203001011200,plain,no quotes,1,false\n"
+			"203001011200,\"with, commas\",\"a \"\"quoted\"\" word\",0,true\n"
+			"203001011200,\"two\n"
+			"lines\",\"\",2\r\n"
+			"203001011200,\"\"\"\",\"back\\slash\"\n") == 4);
+
+	TE_CHECK(t_list.size() == 4);
+	TE_CHECK(find_title("due") == -1);
+	TE_CHECK((find_title("plain") != -1) && (t_list.at(find_title("plain")).tag == 1) && !t_list.at(find_title("plain")).completed);
+
+	const int commas = find_title("with, commas");
+	TE_CHECK((commas != -1) && (li_description(t_list.at(commas)) == "a \"quoted\" word") && t_list.at(commas).completed);
+
+	// the list file can't have line breaks and backslashes
+	const int lines = find_title("two lines");
+	TE_CHECK((lines != -1) && li_description(t_list.at(lines)).empty() && (t_list.at(lines).tag == 2));
+	TE_CHECK((find_title("\"") != -1) && (li_description(t_list.at(find_title("\""))) == "back/slash"));
+
+	te_section("CSV: the line numbers of bad records");
+	TE_CHECK(import("203001011200,one,first\n"
+			"\n"
+			"203001011200,,no title\n"
+			"203001011200,\"two\n"
+			"lines\",second\n"
+			"203001011200,three,third,not a tag\n"
+			"203001011200,four,fourth\n") == 3);
+	TE_CHECK(logged(3));
+	TE_CHECK(logged(6));
+	TE_CHECK(!logged(4) && !logged(5) && !logged(7));
+
+	te_section("CSV: a quote that is not closed");
+	TE_CHECK(import("203001011200,one,first\n"
+			"203001011200,\"runaway,second\n"
+			"203001011200,two,third\n") == 2);
+	TE_CHECK(logged(2));
+	TE_CHECK(!logged(1) && !logged(3));
+	TE_CHECK((find_title("one") != -1) && (find_title("two") != -1));
+
+	// it takes the lines after it up to IM_RECORD_MAX, then they are read as records
+	string runaway = "203001011200,\"runaway,first\n";
+	for (int i = 0; i < 10000; i++) runaway += "203001011200,task " + to_string(i) + ",\n";
+	TE_CHECK(runaway.length() > 2 * IM_RECORD_MAX);
+	TE_CHECK(import(runaway) == 10000);
+	TE_CHECK(logged(1));
+	TE_CHECK(!logged(2) && !logged(10001));
+
+	te_section("TSV");
+	TE_CHECK(import("due\ttitle\tdescription\n"
+			"203001011200\tone\t\"quotes\" stay, as do commas\n"
+			"2030-01-01\ttwo\t\t3\tv\n") == 2);
+	TE_CHECK((find_title("one") != -1) && (li_description(t_list.at(find_title("one"))) == "\"quotes\" stay, as do commas"));
+	TE_CHECK((find_title("two") != -1) && (t_list.at(find_title("two")).tag == 3) && t_list.at(find_title("two")).completed);
+}
+
+static void test_ndjson()
+{
+	te_section("NDJSON: escapes");
+	TE_CHECK(import("{\"due\": \"203001011200\", \"title\": \"line\\nbreak\", \"description\": \"\\\"quoted\\\" \\\\ \\t\"}\n"
+			"{ \"title\" : \"caf\\u00e9\", \"due\":\"203001011200\",\"tag\": 2, \"completed\": true }\n"
+			"{\"title\": \"\\ud83d\\ude00\", \"due\": \"203001011200\", \"unknown\": null, \"description\": \"\\/\"}\n") == 3);
+
+	TE_CHECK((find_title("line break") != -1) && (li_description(t_list.at(find_title("line break"))) == "\"quoted\" / \t"));
+
+	const int cafe = find_title("caf\xc3\xa9");
+	TE_CHECK((cafe != -1) && (t_list.at(cafe).tag == 2) && t_list.at(cafe).completed);
+	TE_CHECK((find_title("\xf0\x9f\x98\x80") != -1) && (li_description(t_list.at(find_title("\xf0\x9f\x98\x80"))) == "/"));
+
+	te_section("NDJSON: bad records");
+	TE_CHECK(import("{\"due\": \"203001011200\", \"title\": \"one\"}\n"
+			"{\"due\": \"203001011200\", \"title\": \"cut short\n"
+			"{\"due\": \"203001011200\", \"title\": {\"nested\": 1}}\n"
+			"not an object\n"
+			"{\"due\": \"203001011200\", \"title\": \"two\"}\n") == 2);
+	TE_CHECK(logged(2) && logged(3) && logged(4));
+	TE_CHECK(!logged(1) && !logged(5));
+}
+
+static void test_dues()
+{
+	te_section("dues: accepted");
+	TE_CHECK(import("202402291200,packed,\n"
+			"2024-02-29,date,\n"
+			"2024-02-29 23:59,date and time,\n"
+			"2024-02-29T08:05,ISO,\n"
+			"2099y1m1d12h00,expression,\n"
+			"a1d,relative,\n") == 6);
+	TE_CHECK((find_title("packed") != -1) && (t_list.at(find_title("packed")).due == 202402291200L));
+	TE_CHECK((find_title("date") != -1) && (t_list.at(find_title("date")).due == 202402290000L));
+	TE_CHECK((find_title("date and time") != -1) && (t_list.at(find_title("date and time")).due == 202402292359L));
+	TE_CHECK((find_title("ISO") != -1) && (t_list.at(find_title("ISO")).due == 202402290805L));
+	TE_CHECK((find_title("expression") != -1) && (t_list.at(find_title("expression")).due == 209901011200L));
+	TE_CHECK((find_title("relative") != -1) && (t_list.at(find_title("relative")).due > ti_snapshot().now));
+
+	te_section("dues: rejected, with their lines logged");
+	TE_CHECK(import("N/A,not a time,\n"
+			"tomorrow,a word,\n"
+			"2024-13-01,month 13,\n"
+			"2024-02-30,February 30,\n"
+			"2023-02-29,not a leap year,\n"
+			"2024-01-01 25:00,hour 25,\n"
+			"2024-01-01 lunch,date and a word,\n"
+			"202413011200,packed month 13,\n"
+			"1x,not a field,\n"
+			"a,ok,\n") == 1);
+	TE_CHECK(t_list.size() == 1);
+	TE_CHECK(find_title("ok") != -1);
+	for (int line = 1; line <= 9; line++) TE_CHECK(logged(line));
+	TE_CHECK(!logged(10));
+}
+
+static void test_journal()
+{
+	te_section("journal: an import is saved once, as a whole list");
+	conf_set_cvar("journal", "true");
+	conf_set_cvar("autosave_delay", "0");
+	te_reset(filename);
+	li_save();
+	const long generation = li_generation;
+
+	string contents;
+	for (int i = 0; i < 100; i++) contents += "203001011200,task " + to_string(i) + ",\n";
+	te_write(te_dir() + "import", contents);
+	TE_CHECK(im_import(te_dir() + "import") == 100);
+	li_flush();
+
+	TE_CHECK(li_generation == generation + 1);
+	TE_CHECK(te_read(filename + LI_JOURNAL_SUFFIX).empty());
+
+	li_load(filename);
+	TE_CHECK(t_list.size() == 100);
+
+	conf_set_cvar("journal", "false");
+}
+
+int main()
+{
+	te_init("import_test");
+	filename = te_dir() + "list";
+
+	test_csv();
+	test_ndjson();
+	test_dues();
+	test_journal();
+
+	return te_done();
+}
@@ -0,0 +1,185 @@
+#include "test.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/noaftodo_config.h"
+#include "../src/noaftodo_list.h"
+#include "../src/noaftodo_stats.h"
+
+using namespace std;
+using namespace chrono;
+
+// list_bench [tasks [runs]]: time loading a list of that many tasks.
+// The list is made from a fixed seed, so runs on the same machine compare
+constexpr int LB_TASKS = 200000;
+constexpr int LB_RUNS = 5;
+
+struct lb_entry
+{
+	bool completed;
+	long due;
+	string title;
+	string description;
+	int tag;
+};
+
+// the line by line parser li_load() had before the list file was mapped,
+// without its log line per entry. For comparison
+static size_t lb_reference(const string& filename)
+{
+	vector<lb_entry> list;
+	vector<string> tags;
+
+	ifstream ifile(filename);
+	string entry;
+	int mode = 0;
+
+	while (getline(ifile, entry))
+	{
+		while ((entry != "") && (entry.at(0) == ' ')) entry = entry.substr(1);
+		if ((entry == "") || (entry.at(0) == '#')) continue;
+
+		if (entry.at(0) == '[')
+		{
+			if (entry == "[tags]") mode = 0;
+			if (entry == "[list]") mode = 1;
+			if (entry == "[workspace]") mode = 2;
+			continue;
+		}
+
+		if (mode == 0) tags.push_back(entry);
+		if (mode != 1) continue;
+
+		lb_entry li_entry = { };
+		string temp = "";
+		int token = 0;
+		for (int i = 0; i < (int)entry.length(); i++)
+		{
+			if (entry.at(i) == '\\')
+			{
+				switch (token)
+				{
+					case 0: li_entry.completed = (temp == "v"); break;
+					case 1: li_entry.due = stol(temp); break;
+					case 2: li_entry.title = temp; break;
+					case 3: li_entry.description = temp; break;
+					case 4: li_entry.tag = stoi(temp); break;
+				}
+
+				temp = "";
+				token++;
+			} else temp += entry.at(i);
+		}
+
+		list.push_back(li_entry);
+	}
+
+	return list.size();
+}
+
+// median of the runs, ms
+static double lb_time(const int& runs, const function<void()>& run)
+{
+	vector<double> times;
+	for (int i = 0; i < runs; i++)
+	{
+		const auto start = steady_clock::now();
+		run();
+		times.push_back(duration<double, milli>(steady_clock::now() - start).count());
+	}
+
+	sort(times.begin(), times.end());
+	return times.at(times.size() / 2);
+}
+
+// time spent in the parser so far, us, as the stats have it
+static double lb_parse_us()
+{
+	const string report = st_report();
+	const size_t line = report.find("list.parse count=");
+	if (line == string::npos) return 0;
+
+	const double count = atof(report.c_str() + line + strlen("list.parse count="));
+	const double mean = atof(report.c_str() + report.find("mean=", line) + strlen("mean="));
+	return count * mean;
+}
+
+static void lb_report(const string& what, const double& ms, const int& tasks)
+{
+	cerr << "  " << what << ": " << ms << " ms, " << (ms * 1000000 / tasks) << " ns per task" << endl;
+}
+
+// li_load() runs: all of it, and the parser alone
+static void lb_report_load(const string& what, const int& runs, const function<void()>& load, const int& tasks)
+{
+	const double parsed = lb_parse_us();
+	lb_report(what, lb_time(runs, load), tasks);
+	lb_report(what + ", parser only (mean)", (lb_parse_us() - parsed) / runs / 1000, tasks);
+}
+
+int main(int argc, char* argv[])
+{
+	const int tasks = (argc > 1) ? atoi(argv[1]) : LB_TASKS;
+	const int runs = (argc > 2) ? atoi(argv[2]) : LB_RUNS;
+
+	te_init("list_bench");
+	conf_set_cvar("autosave_delay", "0");
+
+	// two copies of the list: li_load() skips a file it has loaded already
+	const string files[2] = { te_dir() + "list", te_dir() + "copy" };
+	int next = 0;
+	const auto load = [&]()
+	{
+		li_load(files[next]);
+		next = 1 - next;
+	};
+
+	// titles repeat, like the ones of recurring tasks do
+	mt19937_64 rng(1);
+	li_autosave = false;
+	li_load(files[0]);
+
+	vector<noaftodo_entry> entries;
+	vector<string> strings;
+	strings.reserve(tasks * 2);
+	for (int i = 0; i < tasks; i++)
+	{
+		strings.push_back("task " + to_string(rng() % (tasks / 4 + 1)));
+		strings.push_back("description of task " + to_string(i) + ", a line or so of text to go with it");
+
+		const long due = ti_from_minutes(ti_to_minutes(202001010000L) + (int64_t)(rng() % (20 * 365 * 1440)));
+		entries.push_back({ rng() % 10 == 0, due, strings.at(i * 2), strings.at(i * 2 + 1), (int)(rng() % 8), 0 });
+	}
+
+	li_add(entries);
+	for (int tag = 0; tag < 8; tag++) li_tag_rename(tag, "list " + to_string(tag));
+
+	for (const auto& file : files) li_save(file);
+
+	cerr << "list_bench: " << tasks << " tasks, " << te_read(files[0]).length() / 1024 << " KiB, median of " << runs << " runs" << endl;
+
+	lb_report("text, line by line (reference)", lb_time(runs, [&]() { lb_reference(files[0]); }), tasks);
+	lb_report_load("text, li_load()", runs, load, tasks);
+
+	conf_set_cvar("lazy_descriptions", "true");
+	lb_report_load("text, lazy descriptions", runs, load, tasks);
+
+	conf_set_cvar("lazy_descriptions", "false");
+	li_format = LI_FORMAT_BINARY;
+	for (const auto& file : files) li_save(file);
+	lb_report_load("binary", runs, load, tasks);
+
+	conf_set_cvar("lazy_descriptions", "true");
+	lb_report_load("binary, lazy descriptions", runs, load, tasks);
+
+	return te_done();
+}
@@ -0,0 +1,740 @@
+#include "test.h"
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+
+#include "../src/noaftodo_config.h"
+#include "../src/noaftodo_list.h"
+
+using namespace std;
+
+static string filename;
+
+// position of the task with the title, -1 if there's none
+static int find_title(const string& title)
+{
+	for (int i = 0; i < (int)t_list.size(); i++)
+		if (t_list.at(i).title == title) return i;
+
+	return -1;
+}
+
+static void add(const string& title, const long& due = 203001011200L)
+{
+	li_add({ false, due, title, title + " description", 0, 0 });
+}
+
+// lines of a file
+static int count_lines(const string& contents)
+{
+	int ret = 0;
+	for (const char& c : contents)
+		if (c == '\n') ret++;
+
+	return ret;
+}
+
+static void test_journal()
+{
+	conf_set_cvar("journal", "true");
+	conf_set_cvar("journal_limit", "65536");
+	conf_set_cvar("autosave_delay", "0");
+
+	te_section("journal: records are appended and replayed");
+	te_reset(filename);
+	add("one");
+	add("two");
+	li_flush();
+
+	const string j_filename = filename + LI_JOURNAL_SUFFIX;
+	const string journal = te_read(j_filename);
+	TE_CHECK(count_lines(journal) == 3);	// generation and two records
+
+	li_load(filename);
+	TE_CHECK(t_list.size() == 2);
+	TE_CHECK(find_title("one") != -1);
+	TE_CHECK(find_title("two") != -1);
+
+	te_section("journal: a crash in the middle of a record");
+	te_write(j_filename, journal + "a\\-\\203001011200\\thr");
+	li_load(filename);
+	TE_CHECK(t_list.size() == 2);
+	TE_CHECK(find_title("thr") == -1);
+	TE_CHECK(find_title("") == -1);
+
+	// the next record does not run into the one cut short
+	add("three");
+	li_flush();
+	TE_CHECK(te_read(j_filename).find("thr\\") == string::npos);
+	TE_CHECK(count_lines(te_read(j_filename)) == 4);
+
+	li_load(filename);
+	TE_CHECK(t_list.size() == 3);
+	TE_CHECK(find_title("three") != -1);
+	TE_CHECK(find_title("thr") == -1);
+
+	te_section("journal: a crash in the middle of its first line");
+	te_reset(filename);
+	add("one");
+	li_save();
+	te_write(j_filename, "# genera");
+	li_load(filename);
+	TE_CHECK(t_list.size() == 1);
+
+	add("two");
+	li_flush();
+	li_load(filename);
+	TE_CHECK(t_list.size() == 2);
+
+	te_section("journal: a journal of another generation");
+	te_reset(filename);
+	add("one");
+	li_save();
+	const long generation = li_generation;
+	add("two");
+	li_flush();
+
+	string other = te_read(j_filename);
+	TE_CHECK(other.find("# generation " + to_string(generation) + "\n") == 0);
+	other.replace(0, other.find('\n'), "# generation " + to_string(generation + 1));
+	te_write(j_filename, other);
+
+	li_load(filename);
+	TE_CHECK(li_generation == generation);
+	TE_CHECK(t_list.size() == 1);
+	TE_CHECK(find_title("two") == -1);
+
+	te_section("journal: folded into the list once it's too big");
+	conf_set_cvar("journal_limit", "100");
+	te_reset(filename);
+	for (int i = 0; i < 5; i++) add("task " + to_string(i));
+	li_flush();
+	TE_CHECK(te_read(j_filename).length() <= 100);
+
+	li_load(filename);
+	TE_CHECK(t_list.size() == 5);
+
+	conf_set_cvar("journal", "false");
+	conf_set_cvar("journal_limit", "65536");
+}
+
+// the list file as li_load() would read it
+static string dump()
+{
+	long generation;
+	uint32_t changes;
+	return li_dump(generation, changes);
+}
+
+static void test_text()
+{
+	te_section("text: what's written is read back as it was");
+	te_reset(filename);
+
+	li_tag_rename(0, "inbox");
+	li_tag_rename(2, "far away  list");
+	li_add({ false, 203001011200L, "plain", "plain description", 0, 0 });
+	li_add({ true, 202001011200L, "  leading spaces", "", 1, 0 });
+	li_add({ false, 203001011200L, "same due, later", "# not a comment", 2, 0 });
+	li_add({ false, 199912312359L, "ünïcödé ✓", "[not a section]", 2, 0 });
+	li_add({ true, 205012312359L, "big ID", "trailing spaces  ", 0, 18000000000000000000ULL });
+	li_flush();
+
+	const string written = dump();
+
+	li_load(filename);
+	TE_CHECK(t_list.size() == 5);
+	TE_CHECK(t_tags.size() == 3);
+	TE_CHECK(t_tags.at(2) == "far away  list");
+
+	// the file is exactly what li_dump() makes of the list it was read into
+	TE_CHECK(te_read(filename) == dump());
+
+	// and that is the list that was written, but for the generation line
+	const auto body = [](const string& contents) { return contents.substr(contents.find("\n[tags]")); };
+	TE_CHECK(body(written) == body(dump()));
+
+	const int big = find_title("big ID");
+	TE_CHECK((big != -1) && (t_list.at(big).id == 18000000000000000000ULL) && t_list.at(big).completed);
+	TE_CHECK((big != -1) && (li_description(t_list.at(big)) == "trailing spaces  "));
+
+	const int spaces = find_title("  leading spaces");
+	TE_CHECK((spaces != -1) && (t_list.at(spaces).due == 202001011200L) && (t_list.at(spaces).tag == 1) && li_description(t_list.at(spaces)).empty());
+
+	// entries with the same due stay in the order they were added
+	TE_CHECK(find_title("plain") < find_title("same due, later"));
+
+	te_section("text: a list written by hand");
+	te_write(filename, "# noaftodo list file\n"
+			"[tags]\n"
+			"inbox\n"
+			"\n"
+			"[list]\n"
+			"   v\\202001011200\\indented\\line\\0\\\n"
+			"-\\203001011200\\no ID\\yet\\0\\\n"
+			"-\\203001011200\\no tag\\\n"
+			"\n"
+			"[workspace]\n");
+	li_load(filename);
+	TE_CHECK(t_list.size() == 3);
+	TE_CHECK((find_title("indented") != -1) && t_list.at(find_title("indented")).completed);
+	TE_CHECK((find_title("no tag") != -1) && (t_list.at(find_title("no tag")).tag == 0));
+
+	// IDs are given to the entries that have none
+	for (const auto& entry : t_list) TE_CHECK(entry.id != 0);
+}
+
+static void test_binary()
+{
+	te_section("binary: what's written is read back as it was");
+	te_reset(filename);
+
+	li_tag_rename(0, "inbox");
+	li_tag_rename(1, "work");
+	li_add({ false, 203001011200L, "plain", "plain description", 0, 0 });
+	li_add({ true, 202001011200L, "  leading spaces", "", 1, 0 });
+	li_add({ false, 203001011200L, "same title", "same title", 1, 0 });
+	li_add({ false, 199912312359L, "ünïcödé ✓", "\\ not a field", 0, 18000000000000000000ULL });
+	li_flush();
+
+	li_format = LI_FORMAT_BINARY;
+	li_save();
+	const string written = dump();
+
+	TE_CHECK(te_read(filename).compare(0, sizeof(LI_BIN_MAGIC), LI_BIN_MAGIC, sizeof(LI_BIN_MAGIC)) == 0);
+
+	li_load(filename);
+	TE_CHECK(li_format == LI_FORMAT_BINARY);
+	TE_CHECK(t_list.size() == 4);
+	TE_CHECK(dump() == written);
+
+	const int big = find_title("ünïcödé ✓");
+	TE_CHECK((big != -1) && (t_list.at(big).id == 18000000000000000000ULL));
+	TE_CHECK((big != -1) && (li_description(t_list.at(big)) == "\\ not a field"));
+
+	te_section("binary: lazy descriptions");
+	conf_set_cvar("lazy_descriptions", "true");
+	te_write(filename + "-copy", te_read(filename));
+	li_load(filename + "-copy");
+	TE_CHECK(t_list.size() == 4);
+	// the workspace has the cvar in it now
+	const auto list_part = [](const string& contents) { return contents.substr(0, contents.find("\n[workspace]")); };
+	TE_CHECK(list_part(dump()) == list_part(written));
+	conf_set_cvar("lazy_descriptions", "false");
+
+	// saved in the format it was loaded in
+	const string binary = te_read(filename);
+	li_load(filename);
+	add("one more");
+	li_flush();
+	li_load(filename);
+	TE_CHECK(li_format == LI_FORMAT_BINARY);
+	TE_CHECK(t_list.size() == 5);
+
+	te_section("binary: damaged files are not read");
+	string damaged = binary;
+	damaged.at(3) = 'X';
+	te_write(filename, damaged);
+	li_load(filename);
+	TE_CHECK(t_list.empty());
+	TE_CHECK(t_tags.empty());
+
+	damaged = binary;
+	damaged.at(sizeof(LI_BIN_MAGIC)) = 99;	// version
+	te_write(filename, damaged);
+	li_load(filename);
+	TE_CHECK(t_list.empty());
+
+	te_write(filename, binary.substr(0, binary.length() / 2));
+	li_load(filename);
+	TE_CHECK(t_list.empty());
+
+	te_write(filename, binary.substr(0, sizeof(LI_BIN_MAGIC) + 2));
+	li_load(filename);
+	TE_CHECK(t_list.empty());
+
+	te_section("binary: a damaged file is not saved over");
+	const string truncated = binary.substr(0, binary.length() - 10);
+	te_write(filename, truncated);
+	li_load(filename);
+	add("after the damage");
+	li_flush();
+	TE_CHECK(te_read(filename + LI_DAMAGED_SUFFIX) == truncated);
+	li_load(filename);
+	TE_CHECK(find_title("after the damage") != -1);
+
+	// a heap size that wraps around. It's the last field of the header:
+	// magic, 4 uint32_t, generation
+	damaged = binary;
+	const uint64_t huge = ~0ULL - 16;
+	memcpy(&damaged.at(sizeof(LI_BIN_MAGIC) + 4 * 4 + 8), &huge, sizeof(huge));
+	te_write(filename, damaged);
+	li_load(filename);
+	TE_CHECK(t_list.empty());
+	add("after the damage");
+	li_flush();
+	TE_CHECK(te_read(filename + LI_DAMAGED_SUFFIX) == damaged);
+}
+
+// every entry is where the index says it is
+static bool index_ok()
+{
+	for (int i = 0; i < (int)t_list.size(); i++)
+		if (li_find(t_list.at(i).id) != i) return false;
+
+	return true;
+}
+
+static void test_ids()
+{
+	te_section("IDs: kept across saves");
+	te_reset(filename);
+	for (int i = 0; i < 20; i++) add("task " + to_string(i), 203001011200L + (i % 3));
+	li_flush();
+
+	vector<uint64_t> ids;
+	for (const auto& entry : t_list) ids.push_back(entry.id);
+
+	li_load(filename);
+	TE_CHECK(t_list.size() == ids.size());
+	for (int i = 0; (i < (int)t_list.size()) && (i < (int)ids.size()); i++) TE_CHECK(t_list.at(i).id == ids.at(i));
+	TE_CHECK(index_ok());
+
+	te_section("IDs: the index follows adds, removes and moves");
+	li_rem(t_list.at(5).id);
+	li_rem(t_list.front().id);
+	add("early", 199001010000L);
+	add("late", 209001010000L);
+	li_mv(t_list.at(3).id, 4);
+	li_comp(t_list.at(7).id);
+	TE_CHECK(t_list.size() == 20);
+	TE_CHECK(index_ok());
+	TE_CHECK(li_find(0) == -1);
+
+	// the one with the ID is removed, wherever it is
+	const uint64_t late = t_list.back().id;
+	li_rem(late);
+	TE_CHECK(li_find(late) == -1);
+	TE_CHECK(find_title("late") == -1);
+	TE_CHECK(index_ok());
+
+	te_section("IDs: files written before IDs");
+	li_flush();	// or the changes would be written over the file
+	const string no_ids = "# noaftodo list file\n[tags]\n\n[list]\n"
+		"-\\203001011200\\one\\first\\0\\\n"
+		"-\\203001011200\\two\\second\\0\\\n"
+		"-\\203001011200\\two\\second\\0\\\n"
+		"v\\203001011200\\three\\third\\1\\\n";
+	te_write(filename, no_ids);
+	te_write(filename + "-copy", no_ids);
+
+	li_load(filename);
+	ids.clear();
+	for (const auto& entry : t_list) ids.push_back(entry.id);
+
+	// every process that loads the file gives the tasks the same IDs
+	li_load(filename + "-copy");
+	TE_CHECK(t_list.size() == 4);
+	for (int i = 0; (i < (int)t_list.size()) && (i < (int)ids.size()); i++) TE_CHECK(t_list.at(i).id == ids.at(i));
+
+	// even to the tasks that are the same
+	TE_CHECK((ids.size() == 4) && (ids.at(1) != ids.at(2)));
+	for (const auto& id : ids) TE_CHECK(id != 0);
+	TE_CHECK(index_ok());
+
+	te_section("IDs: a file with an ID twice");
+	te_write(filename, "# noaftodo list file\n[tags]\n\n[list]\n"
+		"-\\203001011200\\one\\first\\0\\42\\\n"
+		"-\\203001011200\\two\\second\\0\\42\\\n");
+	li_load(filename);
+	TE_CHECK(t_list.size() == 2);
+	TE_CHECK((t_list.size() == 2) && (t_list.at(0).id != t_list.at(1).id));
+	TE_CHECK(li_find(42) != -1);
+	TE_CHECK(index_ok());
+}
+
+static void test_lazy()
+{
+	conf_set_cvar("lazy_descriptions", "true");
+
+	for (const int& format : { LI_FORMAT_TEXT, LI_FORMAT_BINARY })
+	{
+		const string name = (format == LI_FORMAT_TEXT) ? "text" : "binary";
+
+		te_section("lazy descriptions, " + name + ": left in the file");
+		te_reset(filename);
+		for (int i = 0; i < 20; i++) add("task " + to_string(i));
+		li_convert(format);
+		li_flush();
+		te_write(filename + "-copy", te_read(filename));	// li_load() would keep the list it has
+		li_load(filename + "-copy");
+		TE_CHECK(t_list.size() == 20);
+		for (const auto& entry : t_list) TE_CHECK(entry.desc_offset >= 0);
+
+		te_section("lazy descriptions, " + name + ": read after the file is rewritten");
+		li_comp(t_list.at(0).id);
+		add("new one");
+		li_save();
+		TE_CHECK(li_pool->fd != -1);
+		for (const auto& entry : t_list) TE_CHECK(li_description(entry) == string(entry.title) + " description");
+
+		// and the rewritten file has them all
+		const auto old_pool = li_pool;
+		const vector<noaftodo_entry> old_list = t_list;
+		li_load(filename + "-copy");
+		TE_CHECK(t_list.size() == 21);
+		for (const auto& entry : t_list) TE_CHECK(li_description(entry) == string(entry.title) + " description");
+
+		te_section("lazy descriptions, " + name + ": an older generation reads its own file");
+		add("one more");
+		li_save();
+		li_load(filename);
+		for (const auto& entry : old_list)
+			if (entry.desc_offset >= 0) TE_CHECK(li_description(entry, *old_pool) == string(entry.title) + " description");
+	}
+
+	conf_set_cvar("lazy_descriptions", "false");
+	li_convert(LI_FORMAT_TEXT);
+}
+
+// inode of a file, 0 if there's none. Files are replaced, not written over
+static ino_t inode(const string& filename)
+{
+	struct stat st;
+	return (stat(filename.c_str(), &st) == 0) ? st.st_ino : 0;
+}
+
+static bool is_binary(const string& filename)
+{
+	return te_read(filename).compare(0, sizeof(LI_BIN_MAGIC), LI_BIN_MAGIC, sizeof(LI_BIN_MAGIC)) == 0;
+}
+
+static void test_sharded()
+{
+	te_section("sharded: a manifest and a file per list");
+	te_reset(filename);
+	for (int tag = 0; tag < 3; tag++)
+	{
+		li_tag_rename(tag, "list " + to_string(tag));
+		for (int i = 0; i < 5; i++) li_add({ false, 203001011200L + i, "task " + to_string(tag) + to_string(i), "description", tag, 0 });
+	}
+	li_layout(true);
+
+	const string manifest = te_read(filename);
+	TE_CHECK(manifest.find("[shards]") != string::npos);
+	TE_CHECK(manifest.find("list 2") != string::npos);
+	TE_CHECK(manifest.find("task ") == string::npos);
+	for (int tag = 0; tag < 3; tag++)
+	{
+		TE_CHECK(te_read(li_shard_filename(tag)).find("task " + to_string(tag) + "0") != string::npos);
+		TE_CHECK(te_read(li_shard_filename(tag)).find("task " + to_string((tag + 1) % 3) + "0") == string::npos);
+	}
+
+	te_section("sharded: lists are loaded when they're needed");
+	li_load(filename + "-other");
+	li_load(filename);
+	TE_CHECK(li_sharded);
+	TE_CHECK(t_tags.size() == 3);
+	li_shard_need(1);
+	TE_CHECK(t_list.size() == 5);
+	li_shard_need(-1);
+	TE_CHECK(t_list.size() == 15);
+	TE_CHECK(index_ok());
+	for (int i = 1; i < (int)t_list.size(); i++) TE_CHECK(t_list.at(i - 1).due <= t_list.at(i).due);
+
+	te_section("sharded: only the lists that changed are written");
+	const ino_t list0 = inode(li_shard_filename(0));
+	const ino_t list1 = inode(li_shard_filename(1));
+	const ino_t list2 = inode(li_shard_filename(2));
+	li_comp(t_list.at(find_title("task 13")).id);
+	li_flush();
+	TE_CHECK(inode(li_shard_filename(0)) == list0);
+	TE_CHECK(inode(li_shard_filename(1)) != list1);
+	TE_CHECK(inode(li_shard_filename(2)) == list2);
+
+	// a task moved to another list is written to both
+	li_mv(t_list.at(find_title("task 20")).id, 0);
+	li_flush();
+	TE_CHECK(inode(li_shard_filename(0)) != list0);
+	TE_CHECK(inode(li_shard_filename(2)) != list2);
+
+	te_section("sharded: a list changed by someone else is read again");
+	string changed = te_read(li_shard_filename(1));
+	changed.replace(changed.find("task 14"), 7, "task 14, changed");
+	te_write(li_shard_filename(1), changed);
+	TE_CHECK(li_load());
+	li_shard_need(-1);
+	TE_CHECK(t_list.size() == 15);
+	TE_CHECK(find_title("task 14, changed") != -1);
+	TE_CHECK((find_title("task 13") != -1) && t_list.at(find_title("task 13")).completed);
+	TE_CHECK((find_title("task 20") != -1) && (t_list.at(find_title("task 20")).tag == 0));
+	TE_CHECK(index_ok());
+
+	// nothing changed
+	TE_CHECK(!li_load());
+
+	te_section("sharded: a format change converts every list");
+	li_convert(LI_FORMAT_BINARY);
+	TE_CHECK(!is_binary(filename));	// the manifest is text
+	for (int tag = 0; tag < 3; tag++) TE_CHECK(is_binary(li_shard_filename(tag)));
+
+	li_load(filename + "-other");
+	li_load(filename);
+	li_shard_need(-1);
+	TE_CHECK(t_list.size() == 15);
+	TE_CHECK(li_format == LI_FORMAT_BINARY);
+
+	li_convert(LI_FORMAT_TEXT);
+	for (int tag = 0; tag < 3; tag++) TE_CHECK(!is_binary(li_shard_filename(tag)));
+
+	te_section("sharded: back to one file");
+	li_layout(false);
+	for (int tag = 0; tag < 3; tag++) TE_CHECK(inode(li_shard_filename(tag)) == 0);
+	li_load(filename + "-other");
+	li_load(filename);
+	TE_CHECK(!li_sharded);
+	TE_CHECK(t_list.size() == 15);
+	TE_CHECK(t_tags.size() == 3);
+}
+
+static void test_writer()
+{
+	te_section("writer: changes made together are written together");
+	conf_set_cvar("autosave_delay", "50");
+	te_reset(filename);
+	const long generation = li_generation;
+	for (int i = 0; i < 100; i++) add("task " + to_string(i));
+	li_flush();
+	TE_CHECK(li_generation == generation + 1);
+
+	li_load(filename);
+	TE_CHECK(t_list.size() == 100);
+
+	te_section("writer: writes on its own after autosave_delay");
+	conf_set_cvar("autosave_delay", "10");
+	add("one more");
+	this_thread::sleep_for(chrono::milliseconds(500));
+	TE_CHECK(te_read(filename).find("one more") != string::npos);
+	li_flush();
+
+	te_section("writer: journal records keep their order");
+	conf_set_cvar("journal", "true");
+	te_reset(filename);
+	add("first");
+	li_save();
+	for (int i = 0; i < 50; i++) add("task " + to_string(i));
+	li_rem(t_list.at(find_title("first")).id);
+	li_flush();
+	TE_CHECK(count_lines(te_read(filename + LI_JOURNAL_SUFFIX)) == 52);
+
+	li_load(filename);
+	TE_CHECK(t_list.size() == 50);
+	TE_CHECK(find_title("first") == -1);
+	conf_set_cvar("journal", "false");
+
+	te_section("writer: the format changes under pending changes");
+	conf_set_cvar("autosave_delay", "1000");
+	te_reset(filename);
+	for (int i = 0; i < 10; i++) add("task " + to_string(i));
+	li_convert(LI_FORMAT_BINARY);
+	add("after");
+	li_flush();
+	TE_CHECK(te_read(filename).compare(0, sizeof(LI_BIN_MAGIC), LI_BIN_MAGIC, sizeof(LI_BIN_MAGIC)) == 0);
+
+	li_load(filename);
+	TE_CHECK(t_list.size() == 11);
+	li_convert(LI_FORMAT_TEXT);
+	TE_CHECK(te_read(filename).compare(0, sizeof(LI_BIN_MAGIC), LI_BIN_MAGIC, sizeof(LI_BIN_MAGIC)) != 0);
+
+	te_section("writer: changes from another thread");
+	conf_set_cvar("autosave_delay", "1");
+	te_reset(filename);
+	thread other([]()
+	{
+		for (int i = 0; i < 200; i++) add("other " + to_string(i));
+	});
+	for (int i = 0; i < 200; i++)
+	{
+		add("this " + to_string(i));
+		if (i % 20 == 0) li_flush();
+	}
+	other.join();
+	li_flush();
+
+	TE_CHECK(t_list.size() == 400);
+	TE_CHECK(index_ok());
+	li_load(filename);
+	TE_CHECK(t_list.size() == 400);
+
+	conf_set_cvar("autosave_delay", "0");
+}
+
+static void test_reload()
+{
+	te_section("reload: an unchanged file is not read again");
+	te_reset(filename);
+	add("one");
+	li_flush();
+	li_load(filename);
+	TE_CHECK(!li_load());
+	TE_CHECK(!li_load());
+	TE_CHECK(t_list.size() == 1);
+
+	// once the file the list was saved to is read, it isn't read again
+	add("two");
+	li_flush();
+	li_load();
+	TE_CHECK(!li_load());
+	TE_CHECK(t_list.size() == 2);
+
+	te_section("reload: a file changed by someone else is read again");
+	const auto by_hand = [](const string& title)
+	{
+		return "# noaftodo list file\n"
+			"[tags]\n"
+			"inbox\n"
+			"\n"
+			"[list]\n"
+			"-\\203001011200\\" + title + "\\description\\0\\\n"
+			"\n"
+			"[workspace]\n"
+			"set \"reload_test\" \"from the list\"\n";
+	};
+	te_write(filename, by_hand("by hand"));
+	TE_CHECK(li_load());
+	TE_CHECK((t_list.size() == 1) && (find_title("by hand") != -1));
+	TE_CHECK(conf_get_cvar("reload_test") == "from the list");
+
+	te_section("reload: the daemon's reader does not run the workspace");
+	conf_set_cvar("reload_test", "");
+	li_exec_workspace = false;
+	te_write(filename, by_hand("by hand again"));
+	TE_CHECK(li_load());
+	TE_CHECK(find_title("by hand again") != -1);
+	TE_CHECK(conf_get_cvar("reload_test") == "");
+	li_exec_workspace = true;
+}
+
+static void test_states()
+{
+	te_section("states: against the snapshot");
+	te_reset(filename);
+	li_add({ true, 202912011200L, "done", "", 0, 0 });
+	add("failed", 202912311200L);
+	add("coming", 203001020000L);
+	add("later", 203001030000L);
+	add("uncat", 203001101200L);
+
+	const ti_snapshot_s first = { 0, 203001011200L, 203001021200L };
+	li_update_states(first);
+	const auto state = [](const string& title) { return li_cols.state.at(find_title(title)); };
+	TE_CHECK(state("done") == LI_S_COMPLETE);
+	TE_CHECK(state("failed") == LI_S_FAILED);
+	TE_CHECK(state("coming") == LI_S_COMING);
+	TE_CHECK(state("later") == LI_S_UNCAT);
+	TE_CHECK(state("uncat") == LI_S_UNCAT);
+
+	te_section("states: a later snapshot updates the ones that crossed a threshold");
+	const ti_snapshot_s second = { 0, 203001021300L, 203001031300L };
+	li_update_states(second);
+	TE_CHECK(state("coming") == LI_S_FAILED);
+	TE_CHECK(state("later") == LI_S_COMING);
+	TE_CHECK(state("uncat") == LI_S_UNCAT);
+
+	vector<uint8_t> states;
+	li_classify(second.now, second.coming, states);
+	TE_CHECK(states == li_cols.state);
+
+	te_section("states: the clock goes back");
+	li_update_states(first);
+	TE_CHECK(state("coming") == LI_S_COMING);
+	TE_CHECK(state("later") == LI_S_UNCAT);
+
+	te_section("states: an entry added or completed gets its state");
+	add("new", 203001011000L);
+	TE_CHECK(state("new") == LI_S_FAILED);
+	li_comp(t_list.at(find_title("new")).id);
+	TE_CHECK(state("new") == LI_S_COMPLETE);
+}
+
+static void test_swap()
+{
+	te_section("swap: two lists stay apart");
+	conf_set_cvar("autosave_delay", "1000");
+	te_reset(filename);
+	add("first list");
+	li_tag_rename(0, "first");
+
+	li_context_s other;
+	li_swap(other);
+	TE_CHECK(t_list.empty() && t_tags.empty() && li_index.empty());
+	TE_CHECK(li_filename == ".noaftodo-list");
+	TE_CHECK(li_find(other.list.at(0).id) == -1);
+
+	// the change went to the file of its list
+	TE_CHECK(te_read(filename).find("first list") != string::npos);
+
+	li_load(filename + "-second");
+	add("second list");
+	add("second list, one more");
+	li_tag_rename(1, "second");
+	li_convert(LI_FORMAT_BINARY);
+	li_bulk_begin();
+	add("second list, in a bulk edit");
+
+	li_swap(other);
+	TE_CHECK(li_filename == filename);
+	TE_CHECK(li_format == LI_FORMAT_TEXT);
+	TE_CHECK((li_bulk == 0) && li_sorted);
+	TE_CHECK(t_list.size() == 1);
+	TE_CHECK(find_title("first list") != -1);
+	TE_CHECK((t_tags.size() == 1) && (t_tags.at(0) == "first"));
+	TE_CHECK(index_ok());
+
+	add("first list, one more");
+	li_flush();
+	TE_CHECK(te_read(filename).find("second") == string::npos);
+
+	li_swap(other);
+	TE_CHECK(li_filename == filename + "-second");
+	TE_CHECK((li_bulk == 1) && !li_sorted);
+	TE_CHECK(t_list.size() == 3);
+	li_bulk_end();
+	TE_CHECK(index_ok());
+	li_flush();
+	TE_CHECK(find_title("first list") == -1);
+	TE_CHECK(is_binary(filename + "-second"));
+
+	li_swap(other);
+	li_load(filename + "-second");
+	TE_CHECK(t_list.size() == 3);
+	TE_CHECK(find_title("first list") == -1);
+	li_load(filename);
+	TE_CHECK(t_list.size() == 2);
+	TE_CHECK(find_title("second list") == -1);
+
+	conf_set_cvar("autosave_delay", "0");
+}
+
+int main()
+{
+	te_init("list_test");
+	filename = te_dir() + "list";
+
+	test_journal();
+	test_text();
+	test_binary();
+	test_ids();
+	test_lazy();
+	test_sharded();
+	test_writer();
+	test_reload();
+	test_states();
+	test_swap();
+
+	return te_done();
+}
@@ -0,0 +1,84 @@
+#include "test.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../src/noaftodo_stats.h"
+
+using namespace std;
+using namespace chrono;
+
+// the line of the metric in the report, "" if there's none
+static string line(const string& report, const string& name)
+{
+	const size_t pos = report.find("\n" + name + " ");
+	if (pos == string::npos) return "";
+
+	return report.substr(pos + 1, report.find('\n', pos + 1) - pos - 1);
+}
+
+// a field of a histogram line, -1 if it's not there
+static long field(const string& line, const string& name)
+{
+	const size_t pos = line.find(" " + name + "=");
+	return (pos == string::npos) ? -1 : atol(line.c_str() + pos + name.length() + 2);
+}
+
+static void test_report()
+{
+	te_section("report: counters and gauges");
+	st_count("test.counter");
+	st_count("test.counter", 4);
+	st_set("test.gauge", 7);
+	st_set("test.gauge", -3);
+	const string report = st_report();
+	TE_CHECK(report.compare(0, 7, "uptime ") == 0);
+	TE_CHECK(line(report, "test.counter") == "test.counter 5");
+	TE_CHECK(line(report, "test.gauge") == "test.gauge -3");
+	TE_CHECK(line(report, "test.none") == "");
+
+	te_section("report: histograms");
+	// 99 that take next to nothing, one that takes 100 ms
+	for (int i = 0; i < 99; i++) st_time("test.time", steady_clock::now());
+	st_time("test.time", steady_clock::now() - milliseconds(100));
+	const string time = line(st_report(), "test.time");
+	TE_CHECK(field(time, "count") == 100);
+	TE_CHECK(field(time, "mean") >= 1000);
+	TE_CHECK(field(time, "p50") < 100);
+	TE_CHECK(field(time, "p99") < 100);
+	TE_CHECK(field(time, "max") >= 100000);
+}
+
+static void test_write()
+{
+	te_section("write: the file is replaced as a whole, only the user can read it");
+	const string filename = te_dir() + "stats";
+	TE_CHECK(st_write(filename));
+	TE_CHECK(line(te_read(filename), "test.counter") == "test.counter 5");
+
+	struct stat st;
+	TE_CHECK((stat(filename.c_str(), &st) == 0) && ((st.st_mode & 0777) == 0600));
+
+	te_section("write: links in its place and where a temporary file could be are not followed");
+	const string target = te_dir() + "target";
+	te_write(target, "not the stats\n");
+	remove(filename.c_str());
+	TE_CHECK(symlink(target.c_str(), filename.c_str()) == 0);
+	TE_CHECK(symlink(target.c_str(), (filename + ".tmp").c_str()) == 0);
+	TE_CHECK(st_write(filename));
+	TE_CHECK(te_read(target) == "not the stats\n");
+	TE_CHECK((lstat(filename.c_str(), &st) == 0) && S_ISREG(st.st_mode));
+}
+
+int main()
+{
+	te_init("stats_test");
+
+	test_report();
+	test_write();
+
+	return te_done();
+}
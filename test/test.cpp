@@ -0,0 +1,103 @@
+#include "test.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "../src/noaftodo_config.h"
+#include "../src/noaftodo_list.h"
+
+using namespace std;
+
+static string te_name;
+static string te_directory;
+static string te_current;	// section
+static int te_checks = 0;
+static int te_failed = 0;
+
+void te_check(const bool& ok, const char* what, const char* file, const int& line)
+{
+	te_checks++;
+	if (ok) return;
+
+	te_failed++;
+	cerr << file << ":" << line << ": " << te_name << ": " << te_current << ": " << what << " failed" << endl;
+}
+
+void te_init(const string& name)
+{
+	te_name = name;
+
+	char dir[] = "/tmp/noaftodo-test.XXXXXX";
+	if (mkdtemp(dir) == nullptr)
+	{
+		cerr << name << ": can't make a directory for the test" << endl;
+		exit(1);
+	}
+	te_directory = string(dir) + '/';
+
+	// the log would drown the report
+	if (freopen((te_directory + name + ".log").c_str(), "w", stdout) == nullptr)
+	{
+		cerr << name << ": can't open the log" << endl;
+		exit(1);
+	}
+
+	conf_load(te_directory + "noaftodo.conf");
+	li_filename = te_directory + "list";
+}
+
+int te_done()
+{
+	// benchmarks check nothing
+	cerr << te_name << ": ";
+	if (te_checks > 0) cerr << (te_checks - te_failed) << "/" << te_checks << " checks passed";
+	else cerr << "done";
+
+	// the files are left for a look at what went wrong
+	if (te_failed == 0) filesystem::remove_all(te_directory);
+	else cerr << ", see " << te_directory;
+
+	cerr << endl;
+
+	return (te_failed == 0) ? 0 : 1;
+}
+
+void te_section(const string& name)
+{
+	te_current = name;
+	cout << "[t] " << name << endl;
+}
+
+string te_dir()
+{
+	return te_directory;
+}
+
+string te_read(const string& filename)
+{
+	ifstream ifile(filename, ios::in | ios::binary);
+	return string((istreambuf_iterator<char>(ifile)), istreambuf_iterator<char>());
+}
+
+void te_write(const string& filename, const string& contents)
+{
+	ofstream ofile(filename, ios::out | ios::binary | ios::trunc);
+	ofile << contents;
+}
+
+void te_reset(const string& filename)
+{
+	li_flush();
+
+	for (const auto& entry : filesystem::directory_iterator(te_directory))
+	{
+		const string path = entry.path().string();
+		if (path.compare(0, filename.length(), filename) == 0) filesystem::remove(entry.path());
+	}
+
+	li_load(filename);
+}
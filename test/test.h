@@ -0,0 +1,26 @@
+#ifndef NOAFTODO_TEST_H
+#define NOAFTODO_TEST_H
+
+#include <string>
+
+// a failed check is reported and counted, the test goes on
+#define TE_CHECK(cond) te_check((cond), #cond, __FILE__, __LINE__)
+
+void te_check(const bool& ok, const char* what, const char* file, const int& line);
+
+// set up the test: a fresh directory, a config made from the template
+// and the list file in it. Log goes to <name>.log in the directory
+void te_init(const std::string& name);
+int te_done();		// report. The test exits with it: 0 - all checks passed
+
+void te_section(const std::string& name);	// a group of checks, for the report
+
+std::string te_dir();	// the directory of the test, ends with '/'
+
+std::string te_read(const std::string& filename);
+void te_write(const std::string& filename, const std::string& contents);
+
+// start the list over: nothing loaded, nothing on disk
+void te_reset(const std::string& filename);
+
+#endif
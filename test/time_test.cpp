@@ -0,0 +1,190 @@
+#include "test.h"
+
+#include <cstdlib>
+#include <ctime>
+#include <string>
+
+#include "../src/noaftodo_time.h"
+
+using namespace std;
+
+// a time as libc sees it on a calendar with no zones, minutes
+static int64_t libc_minutes(const long& t_long)
+{
+	tm t_tm = ti_to_tm(t_long);
+	t_tm.tm_year -= 1900;
+	t_tm.tm_mon -= 1;
+
+	return timegm(&t_tm) / 60;
+}
+
+static void test_minutes()
+{
+	te_section("minutes: every day agrees with libc");
+	bool same = true;
+	bool consecutive = true;
+	long prev = 0;
+	for (int64_t day = ti_days_from_civil(1900, 1, 1); day <= ti_days_from_civil(2200, 12, 31); day++)
+	{
+		const long t_long = ti_from_minutes(day * 1440 + 12 * 60 + 34);
+		same = same && (libc_minutes(t_long) == day * 1440 + 12 * 60 + 34) && (ti_to_minutes(t_long) == day * 1440 + 12 * 60 + 34);
+		consecutive = consecutive && ((prev == 0) || (t_long > prev));
+		prev = t_long;
+	}
+	TE_CHECK(same);
+	TE_CHECK(consecutive);
+
+	te_section("minutes: leap years and month ends");
+	const auto next_day = [](const long& t_long) { return ti_from_minutes(ti_to_minutes(t_long) + 24 * 60); };
+	TE_CHECK(next_day(202402281200L) == 202402291200L);
+	TE_CHECK(next_day(202302281200L) == 202303011200L);
+	TE_CHECK(next_day(200002281200L) == 200002291200L);
+	TE_CHECK(next_day(190002281200L) == 190003011200L);
+	TE_CHECK(next_day(210002281200L) == 210003011200L);
+	TE_CHECK(next_day(202404301200L) == 202405011200L);
+	TE_CHECK(next_day(202412311200L) == 202501011200L);
+	TE_CHECK(ti_from_minutes(ti_to_minutes(202312312359L) + 1) == 202401010000L);
+	TE_CHECK(ti_from_minutes(ti_to_minutes(202403010000L) - 1) == 202402292359L);
+
+	te_section("minutes: the snapshot");
+	const ti_snapshot_s snapshot = ti_snapshot();
+	TE_CHECK(snapshot.coming == next_day(snapshot.now));
+	TE_CHECK(ti_to_time(snapshot.now) / 60 == snapshot.time / 60);
+}
+
+static void test_dst()
+{
+	// Central European Time, without the zone files
+	setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+	tzset();
+
+	te_section("DST: local times");
+	// 2024-03-31 02:00 - 03:00 does not exist, 2024-10-27 02:00 - 03:00 happens twice
+	TE_CHECK(ti_to_time(202403310300L) - ti_to_time(202403310100L) == 3600);
+	TE_CHECK(ti_to_time(202404010000L) - ti_to_time(202403310000L) == 23 * 3600);
+	TE_CHECK(ti_to_time(202410280000L) - ti_to_time(202410270000L) == 25 * 3600);
+	TE_CHECK(ti_to_time(202410270400L) - ti_to_time(202410270100L) == 4 * 3600);
+
+	const time_t gap = ti_to_time(202403310230L);
+	TE_CHECK((gap > ti_to_time(202403310159L)) && (gap < ti_to_time(202403310400L)));
+
+	te_section("DST: a day later is the same wall clock time");
+	// the calendar has no zones: adding a day is 1440 minutes, whatever the clocks do
+	const long before = 202403301200L;
+	const long after = ti_from_minutes(ti_to_minutes(before) + 24 * 60);
+	TE_CHECK(after == 202403311200L);
+	TE_CHECK(ti_to_time(after) - ti_to_time(before) == 23 * 3600);
+
+	unsetenv("TZ");
+	tzset();
+}
+
+// what ti_to_tm(string) did before expressions were compiled, at "now".
+// Its calendar knew no centuries and rolled months over one at a time:
+// only times it got right are compared to
+static long old_to_long(const string& t_str, const long& now)
+{
+	tm ti = { };
+	const tm l_ti = ti_to_tm(now);
+
+	int year = 0, month = 0, day = 0, hour = 0, minute = 0;
+	bool c_year = false, c_mon = false, c_day = false, c_hour = false, c_min = false;
+
+	for (int i = 0; i <= (int)t_str.length(); i++)
+	{
+		const char c = (i == (int)t_str.length()) ? 'a' : t_str.at(i);
+
+		if (isdigit(c)) { minute = minute * 10 + (c - '0'); c_min = true; }
+		else
+		{
+			switch (c)
+			{
+				case 'a':
+					if (!c_year) ti.tm_year = l_ti.tm_year;
+					if (!c_mon) ti.tm_mon = l_ti.tm_mon;
+					if (!c_day) ti.tm_mday = l_ti.tm_mday;
+					if (!c_hour) ti.tm_hour = l_ti.tm_hour;
+					if (!c_min) ti.tm_min = l_ti.tm_min;
+					break;
+				case 'h': hour = minute; c_hour = true; minute = 0; break;
+				case 'd': day = minute; c_day = true; minute = 0; break;
+				case 'm': month = minute; c_mon = true; minute = 0; break;
+				case 'y': year = minute; c_year = true; minute = 0; break;
+			}
+
+			c_min = false;
+		}
+	}
+
+	ti.tm_year += year;
+	ti.tm_mon += month;
+	ti.tm_mday += day;
+	ti.tm_hour += hour;
+	ti.tm_min += minute;
+
+	if (ti.tm_min >= 60) { ti.tm_hour += ti.tm_min / 60; ti.tm_min = ti.tm_min % 60; }
+	if (ti.tm_hour >= 24) { ti.tm_mday += ti.tm_hour / 24; ti.tm_hour = ti.tm_hour % 24; }
+
+	const auto days_in_month = [&ti]() { return (ti.tm_mon == 2) ? ((ti.tm_year % 4 == 0) ? 29 : 28) : ((ti.tm_mon <= 7) ? (30 + (ti.tm_mon % 2)) : (31 - (ti.tm_mon % 2))); };
+	while (ti.tm_mday > days_in_month())
+	{
+		ti.tm_mday -= days_in_month();
+		ti.tm_mon++;
+	}
+
+	if (ti.tm_mon > 12) { ti.tm_year += ti.tm_mon / 12; ti.tm_mon = ti.tm_mon % 12; }
+
+	return ti_to_long(ti);
+}
+
+static void test_expressions()
+{
+	te_section("expressions: the same as before they were compiled");
+	const string exprs[] = { "a", "a0d", "a1d", "a2d", "a1h", "a90", "a12h30", "a2d3h", "a1d1h30", "2d3h", "2099y1m1d12h00", "2030y6m15d" };
+	string differs;		// the first one that does not
+	for (int64_t day = ti_days_from_civil(2023, 1, 1); day <= ti_days_from_civil(2025, 12, 31); day++)
+		for (const int& minute : { 0, 11 * 60 + 59, 23 * 60 + 30 })
+		{
+			const long now = ti_from_minutes(day * 1440 + minute);
+			for (const auto& expr : exprs)
+				if (differs.empty() && (ti_eval(ti_compile(expr), now) != old_to_long(expr, now)))
+					differs = expr + " at " + to_string(now);
+		}
+	TE_CHECK(differs == "");
+
+	te_section("expressions: months and years roll over");
+	TE_CHECK(ti_to_long("a1m", 202312150800L) == 202401150800L);
+	TE_CHECK(ti_to_long("a1m", 202312310800L) == 202401310800L);
+	TE_CHECK(ti_to_long("a1m", 202401311200L) == 202403021200L);
+	TE_CHECK(ti_to_long("a1m", 202301311200L) == 202303031200L);
+	TE_CHECK(ti_to_long("a13m", 202311050000L) == 202412050000L);
+	TE_CHECK(ti_to_long("a24m", 202311050000L) == 202511050000L);
+	TE_CHECK(ti_to_long("a1y", 202402291000L) == 202503011000L);
+	TE_CHECK(ti_to_long("a45d", 202312200000L) == 202402030000L);
+	TE_CHECK(ti_to_long("a1d", 209912312359L) == 210001012359L);
+	TE_CHECK(ti_to_long("a1d", 210002281200L) == 210003011200L);
+	TE_CHECK(ti_to_long("a1d", 202403301200L) == 202403311200L);
+
+	te_section("expressions: compiled once");
+	TE_CHECK(ti_expr("a1d").now[TI_YEAR] && (ti_expr("a1d").delta[TI_DAY] == 1));
+	// more than the cache keeps: the ones thrown out are compiled again
+	bool cached = true;
+	for (int i = 0; i < (int)TI_EXPR_CACHE * 3; i++)
+	{
+		const string expr = "a" + to_string(i) + "h";
+		cached = cached && (ti_eval(ti_expr(expr), 202401010000L) == ti_from_minutes(ti_to_minutes(202401010000L) + i * 60));
+		cached = cached && (ti_eval(ti_expr("a1d"), 202401010000L) == 202401020000L);
+	}
+	TE_CHECK(cached);
+}
+
+int main()
+{
+	te_init("time_test");
+
+	test_minutes();
+	test_dst();
+	test_expressions();
+
+	return te_done();
+}